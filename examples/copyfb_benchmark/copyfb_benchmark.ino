@@ -0,0 +1,92 @@
+/********************************************************************
+*
+* ILI9488_T4 library example. Benchmark of the framebuffer copies.
+*
+* This sketch does not need a screen. It measures the speed of
+* DiffBuffBase::copyfb() for each orientation, both for full frames
+* and for sub-rectangles (as used with dirty regions and partial
+* updates). Results are printed on Serial in CPU cycles per pixel.
+*
+* The copies are done by the driver whenever a diff is computed
+* without copying the framebuffer (e.g. while an async update is
+* ongoing) so their cost is on the critical path of each frame.
+********************************************************************/
+
+#include <Arduino.h>
+#include <ILI9488_T4.h>
+
+
+#define NB_REPEAT 50    // number of copies for each measurement
+
+// screen size in orientation 0 (set by the library build, see ILI9488_T4_TFTWIDTH/HEIGHT in DiffBuff.h)
+const int LX = ILI9488_T4_TFTWIDTH;
+const int LY = ILI9488_T4_TFTHEIGHT;
+
+// framebuffers (same placement as usually done with the driver)
+DMAMEM uint16_t fb_internal[LX * LY];   // internal framebuffer
+uint16_t fb[LX * LY];                   // the framebuffer drawn by the user
+
+
+const char* orientation_names[4] = { "portrait", "landscape", "portrait flipped", "landscape flipped" };
+
+
+/** return the number of cycles per pixel for a full frame copy */
+float benchFull(int orientation)
+    {
+    uint32_t cycles = 0;
+    for (int k = 0; k < NB_REPEAT; k++)
+        {
+        const uint32_t t = ARM_DWT_CYCCNT;
+        ILI9488_T4::DiffBuffBase::copyfb(fb_internal, fb, orientation);
+        cycles += ARM_DWT_CYCCNT - t;
+        }
+    return ((float)cycles) / (((float)NB_REPEAT) * LX * LY);
+    }
+
+
+/** return the number of cycles per pixel for a copy of the sub-rectangle [xmin, xmax] x [ymin, ymax] */
+float benchSub(int orientation, int xmin, int xmax, int ymin, int ymax)
+    {
+    const int stride = (orientation & 1) ? LY : LX;
+    const uint16_t* src = fb + xmin + stride * ymin;
+    uint32_t cycles = 0;
+    for (int k = 0; k < NB_REPEAT; k++)
+        {
+        const uint32_t t = ARM_DWT_CYCCNT;
+        ILI9488_T4::DiffBuffBase::copyfb(fb_internal, src, xmin, xmax, ymin, ymax, stride, orientation);
+        cycles += ARM_DWT_CYCCNT - t;
+        }
+    return ((float)cycles) / (((float)NB_REPEAT) * (xmax - xmin + 1) * (ymax - ymin + 1));
+    }
+
+
+void setup()
+    {
+    Serial.begin(9600);
+    while (!Serial);
+
+    // enable the cycle counter
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+
+    for (int i = 0; i < LX * LY; i++) fb[i] = (uint16_t)(i * 2654435761u >> 16);
+
+    Serial.println("\ncopyfb() benchmark (CPU cycles per pixel)\n");
+    for (int orientation = 0; orientation < 4; orientation++)
+        {
+        const int w = (orientation & 1) ? LY : LX;
+        const int h = (orientation & 1) ? LX : LY;
+        Serial.printf("- %-18s : full frame %5.2f   large rect %5.2f   small rect %5.2f   odd rect %5.2f\n",
+            orientation_names[orientation],
+            benchFull(orientation),
+            benchSub(orientation, 16, w - 17, 16, h - 17),
+            benchSub(orientation, 40, 103, 60, 123),
+            benchSub(orientation, 7, 7 + 100, 13, 13 + 76));
+        }
+    Serial.println("\ndone.");
+    }
+
+
+void loop()
+    {
+    }
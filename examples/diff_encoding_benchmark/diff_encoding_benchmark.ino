@@ -0,0 +1,182 @@
+/********************************************************************
+*
+* ILI9488_T4 library example. Benchmark of the diff encodings.
+*
+* This sketch does not need a screen. It compares the two encodings
+* available for DiffBuff objects:
+*
+* - ENCODING_VARIABLE : runs stored with 1, 2 or 3 bytes per value (default).
+* - ENCODING_WORD32   : runs stored as aligned 32 bit words.
+*
+* For several kinds of content, it reports the time needed to compute
+* the diffs (encode), the time needed to read them back with readDiff()
+* as done in the DMA interrupt during upload (decode) and the average
+* number of bytes used per frame. Results are printed on Serial.
+********************************************************************/
+
+#include <Arduino.h>
+#include <ILI9488_T4.h>
+
+
+#define NB_FRAMES 100   // number of frames per scene
+#define DIFF_SIZE 40000 // size of the diff buffers
+
+
+// the two diff buffers (one for each encoding)
+ILI9488_T4::DiffBuffStatic<DIFF_SIZE> diff_var;
+ILI9488_T4::DiffBuffStatic<DIFF_SIZE> diff_w32;
+
+// screen size in orientation 0 (set by the library build, see ILI9488_T4_TFTWIDTH/HEIGHT in DiffBuff.h)
+const int LX = ILI9488_T4_TFTWIDTH;
+const int LY = ILI9488_T4_TFTHEIGHT;
+
+// framebuffers
+DMAMEM uint16_t fb_screen[LX * LY];   // what is "on the screen"
+uint16_t fb[LX * LY];                 // the new frame
+
+
+/********************************************************************
+* Scenes
+********************************************************************/
+
+uint32_t rnd_state = 1;
+
+/** xorshift random generator */
+uint32_t rnd()
+    {
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+    }
+
+
+/** fill a rectangle */
+void fillRect(uint16_t* fb, int x, int y, int w, int h, uint16_t color)
+    {
+    for (int j = max(0, y); j < min(LY, y + h); j++)
+        for (int i = max(0, x); i < min(LX, x + w); i++) fb[i + LX * j] = color;
+    }
+
+
+/** draw a fake line of text (small random glyphs) */
+void drawText(uint16_t* fb, int x, int y, int nbchar, uint16_t color)
+    {
+    for (int c = 0; c < nbchar; c++)
+        for (int j = 0; j < 10; j++)
+            for (int i = 0; i < 6; i++)
+                if (rnd() % 3 == 0) fb[min(LX - 1, x + 7 * c + i) + LX * min(LY - 1, y + j)] = color;
+    }
+
+
+/** static background with a gradient */
+void background(uint16_t* fb)
+    {
+    for (int j = 0; j < LY; j++)
+        for (int i = 0; i < LX; i++) fb[i + LX * j] = ((j * 31 / LY) << 11) | ((i * 63 / LX) << 5) | 8;
+    }
+
+
+/** scene 0: user interface, a few widgets (gauges, counters) updated each frame */
+void sceneUI(uint16_t* fb, int frame)
+    {
+    if (frame == 0) background(fb);
+    for (int k = 0; k < 6; k++)
+        {
+        const int y = 20 + 75 * k;
+        fillRect(fb, 10, y, 300, 12, 0);
+        fillRect(fb, 10, y, (frame * (k + 3)) % 300, 12, 0x07E0); // gauge
+        fillRect(fb, 10, y + 20, 120, 10, 0xFFFF);
+        drawText(fb, 10, y + 20, 15, 0);                           // counter
+        }
+    }
+
+
+/** scene 1: sprites moving over a static background */
+void sceneSprites(uint16_t* fb, int frame)
+    {
+    background(fb);
+    for (int k = 0; k < 12; k++)
+        {
+        const int x = (37 * k + 3 * frame) % LX;
+        const int y = (71 * k + 2 * frame * (k % 3 + 1)) % LY;
+        fillRect(fb, x, y, 40, 40, (uint16_t)(0xF800 >> (k % 3)));
+        }
+    }
+
+
+/** scene 2: camera like content (static image with noise on the low bits) */
+void sceneCamera(uint16_t* fb, int frame)
+    {
+    background(fb);
+    for (int i = 0; i < LX * LY; i++)
+        if (rnd() % 4 == 0) fb[i] ^= 0x0821;
+    }
+
+
+/** scene 3: full screen scrolling text */
+void sceneScroll(uint16_t* fb, int frame)
+    {
+    rnd_state = 1;
+    fillRect(fb, 0, 0, LX, LY, 0xFFFF);
+    for (int l = 0; l < LY / 12 + 1; l++) drawText(fb, 4, l * 12 - (frame % 12), 44, 0);
+    }
+
+
+typedef void (*scene_t)(uint16_t*, int);
+const scene_t scenes[4] = { sceneUI, sceneSprites, sceneCamera, sceneScroll };
+const char* scene_names[4] = { "user interface", "moving sprites", "camera noise", "scrolling text" };
+
+
+/********************************************************************
+* Benchmark
+********************************************************************/
+
+
+/** run a scene with a given diff buffer. */
+void bench(int scene, ILI9488_T4::DiffBuff& diff)
+    {
+    uint32_t t_encode = 0, t_decode = 0, nb_bytes = 0, nb_runs = 0;
+    rnd_state = 1;
+    memset(fb_screen, 0, sizeof(fb_screen));
+    for (int frame = 0; frame < NB_FRAMES; frame++)
+        {
+        scenes[scene](fb, frame);
+
+        elapsedMicros em;
+        diff.computeDiff(fb_screen, fb, 0, 6, true, 0); // create the diff and copy (as the driver does)
+        t_encode += em;
+        nb_bytes += diff.size();
+
+        em = 0;
+        diff.initRead(); // read the diff as done in the DMA interrupt
+        int x, y, len;
+        while (diff.readDiff(x, y, len, 2 * LY) == 0) nb_runs++;
+        t_decode += em;
+        }
+    Serial.printf("   %-9s : encode %5uus   decode %5uus   %6u bytes/frame   (%u runs/frame)\n",
+        (diff.encoding() == ILI9488_T4::DiffBuff::ENCODING_WORD32) ? "word32" : "variable",
+        t_encode / NB_FRAMES, t_decode / NB_FRAMES, nb_bytes / NB_FRAMES, nb_runs / NB_FRAMES);
+    }
+
+
+void setup()
+    {
+    Serial.begin(9600);
+    while (!Serial);
+    diff_w32.setEncoding(ILI9488_T4::DiffBuff::ENCODING_WORD32);
+
+    Serial.println("\nDiff encoding benchmark (average per frame)\n");
+    for (int scene = 0; scene < 4; scene++)
+        {
+        Serial.printf("- %s\n", scene_names[scene]);
+        bench(scene, diff_var);
+        bench(scene, diff_w32);
+        }
+    Serial.println("\ndone.");
+    }
+
+
+void loop()
+    {
+    }
@@ -1,5 +1,7 @@
 #include "DiffBuff.h"
 
+#include <atomic>
+
 
 
 namespace ILI9488_T4
@@ -37,6 +39,162 @@ namespace ILI9488_T4
             }
 
 
+        int DiffBuffBase::nbPixels()
+            {
+            initRaw();
+            int n = 0, off = 0;
+            while (1)
+                {
+                int nbwrite, nbskip;
+                readRaw(nbwrite, nbskip);
+                if (nbskip > DiffBuffBase::LX * DiffBuffBase::LY) return n; // TAG_END
+                if (nbwrite > DiffBuffBase::LX * DiffBuffBase::LY) return n + DiffBuffBase::LX * DiffBuffBase::LY - off; // TAG_WRITE_ALL
+                n += nbwrite;
+                off += nbwrite + nbskip;
+                }
+            }
+
+
+        int DiffBuffBase::_splitRun(int& r_x, int& r_y, int& r_len, bool& r_cont, int& x, int& y, int& len, int scanline)
+            {
+            x = r_x;
+            y = r_y;
+            if ((scanline < DiffBuffBase::LY) && (r_y + MIN_SCANLINE_SPACE > scanline))
+                { // we must wait a bit.
+                len = 0;
+                const int l = r_y + MIN_SCANLINE_SPACE;
+                return ((l < DiffBuffBase::LY) ? l : DiffBuffBase::LY);
+                }
+            if (r_x > 0)
+                { // not at the beginning of a line. 
+                if (r_x + r_len <= DiffBuffBase::LX)
+                    { // everything fits on the line
+                    len = r_len;
+                    r_cont = false;
+                    return 0;
+                    }
+                len = DiffBuffBase::LX - r_x;
+                r_len -= len; 
+                r_x = 0;
+                r_y++;
+                return 0;
+                }
+            // at the beginning of a line 
+            int maxl = scanline - r_y; // max number of lines available now
+            if (maxl > MAX_WRITE_LINE) maxl = MAX_WRITE_LINE; // clamp at max value. 
+            const int nbw = maxl * DiffBuffBase::LX; // max number of pixels that we can write 
+            if (r_len <= nbw)
+                { // ok, we can write everything now
+                len = r_len;
+                r_cont = false;
+                return 0;
+                }
+            // cannot write everything yet. 
+            len = nbw;
+            r_len -= nbw;
+            r_x = 0;
+            r_y += maxl;
+            return 0;
+            }
+
+
+        int DiffBuffBase::_readDiffField(int& x, int& y, int& len, int scanline, int field)
+            {
+            if (field < 0) return readDiff(x, y, len, scanline);
+            while (1)
+                {
+                if (_fld_len > 0)
+                    { // rest of the previous instruction (already cleared w.r.t. the scanline)
+                    x = _fld_x;
+                    y = _fld_y;
+                    len = _fld_len;
+                    _fld_len = 0;
+                    }
+                else
+                    {
+                    const int r = readDiff(x, y, len, scanline);
+                    if (r != 0) return r;
+                    }
+                if ((y & 1) != field)
+                    { // drop the part on this line
+                    const int l = DiffBuffBase::LX - x;
+                    if (len <= l) continue;
+                    x = 0;
+                    y++;
+                    len -= l;
+                    }
+                if (x + len > DiffBuffBase::LX)
+                    { // keep the next lines for later
+                    _fld_x = 0;
+                    _fld_y = y + 1;
+                    _fld_len = len - (DiffBuffBase::LX - x);
+                    len = DiffBuffBase::LX - x;
+                    }
+                return 0;
+                }
+            }
+
+
+        int DiffBuffBase::readDiffWindow(int& x, int& y, int& w, int& len, int scanline, int gap, int field)
+            {
+            if (_win_state == 2) return -1; // done
+            if (_win_state == 1)
+                { // use the pending instruction
+                x = _win_x;
+                y = _win_y;
+                len = _win_len;
+                _win_state = 0;
+                }
+            else
+                {
+                const int r = _readDiffField(x, y, len, scanline, field);
+                if (r < 0) _win_state = 2;
+                if (r != 0) 
+                    {
+                    w = DiffBuffBase::LX - x;
+                    return r;
+                    }
+                }
+            w = DiffBuffBase::LX - x;
+            if (x + len > DiffBuffBase::LX) return 0; // multi-line instruction, keep it as is. 
+
+            // single line instruction: try to merge the instructions of the next lines
+            int x1 = x, x2 = x + len - 1; // current window
+            int h = 1;                    // number of lines in the window
+            int waste = 0;                // number of unchanged pixels in the window
+            while (h < MAX_WRITE_LINE)
+                {
+                int nx, ny, nlen;
+                const int r = _readDiffField(nx, ny, nlen, scanline, field);
+                if (r != 0)
+                    { // nothing more for now (the instruction stays in the diff if we must wait). 
+                    if (r < 0) _win_state = 2;
+                    break;
+                    }
+                const int nx1 = (nx < x1) ? nx : x1;
+                const int nx2 = (nx + nlen - 1 > x2) ? (nx + nlen - 1) : x2;
+                const int nwaste = waste + h * ((nx2 - nx1) - (x2 - x1)) + (nx2 - nx1 + 1 - nlen);
+                if ((ny != y + h) || (nx + nlen > DiffBuffBase::LX) || (nwaste > gap * h))
+                    { // cannot be merged: keep it for the next call.
+                    _win_x = nx;
+                    _win_y = ny;
+                    _win_len = nlen;
+                    _win_state = 1;
+                    break;
+                    }
+                x1 = nx1;
+                x2 = nx2;
+                waste = nwaste;
+                h++;
+                }
+            x = x1;
+            w = x2 - x1 + 1;
+            len = (h == 1) ? len : (w * h);
+            if (h == 1) w = DiffBuffBase::LX - x; // still a linear instruction.
+            return 0;
+            }
+
+
         void DiffBuffBase::copyfb(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation)
             {
             switch (fb_new_orientation)
@@ -85,30 +243,148 @@ namespace ILI9488_T4
             }
 
 
+        void DiffBuffBase::copyfb(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, DiffBuffBase* diff)
+            {
+            if ((fb_new_orientation < 0) || (fb_new_orientation > 3)) fb_new_orientation = 0;
+            const int N = DiffBuffBase::LX * DiffBuffBase::LY;
+            int pos = 0;
+            diff->initRaw();
+            while (pos < N)
+                {
+                int nbwrite, nbskip;
+                diff->readRaw(nbwrite, nbskip);
+                if (nbwrite > N - pos) nbwrite = N - pos; // TAG_WRITE_ALL
+                int end = pos + nbwrite;
+                while (pos < end)
+                    { // copy line by line
+                    const int y = pos / DiffBuffBase::LX;
+                    const int x = pos - DiffBuffBase::LX * y;
+                    const int len = ((DiffBuffBase::LX - x) < (end - pos)) ? (DiffBuffBase::LX - x) : (end - pos);
+                    uint16_t* p = fb_old + pos;
+                    switch (fb_new_orientation)
+                        {
+                        case LANDSCAPE_480x320:
+                            {
+                            const uint16_t* q = fb_new + y + DiffBuffBase::LY * (DiffBuffBase::LX - 1 - x);
+                            for (int i = 0; i < len; i++) { p[i] = *q; q -= DiffBuffBase::LY; }
+                            break;
+                            }
+                        case PORTRAIT_320x480_FLIPPED:
+                            {
+                            const uint16_t* q = fb_new + (DiffBuffBase::LX - 1 - x) + DiffBuffBase::LX * (DiffBuffBase::LY - 1 - y);
+                            for (int i = 0; i < len; i++) { p[i] = *(q--); }
+                            break;
+                            }
+                        case LANDSCAPE_480x320_FLIPPED:
+                            {
+                            const uint16_t* q = fb_new + (DiffBuffBase::LY - 1 - y) + DiffBuffBase::LY * x;
+                            for (int i = 0; i < len; i++) { p[i] = *q; q += DiffBuffBase::LY; }
+                            break;
+                            }
+                        default: // PORTRAIT_320x480
+                            memcpy(p, fb_new + pos, len * sizeof(uint16_t));
+                            break;
+                        }
+                    pos += len;
+                    }
+                if (nbskip > N - pos) break; // TAG_END
+                pos += nbskip;
+                }
+            }
+
+
+        void DiffBuffBase::copyfb(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, const Rect* dirty, int nb_dirty)
+            {
+            if ((fb_new_orientation < 0) || (fb_new_orientation > 3)) fb_new_orientation = 0;
+            const int stride = (fb_new_orientation & 1) ? DiffBuffBase::LY : DiffBuffBase::LX;
+            for (int k = 0; k < nb_dirty; k++)
+                {
+                int xmin, xmax, ymin, ymax;
+                if (_clipRect(fb_new_orientation, dirty[k], xmin, xmax, ymin, ymax))
+                    {
+                    copyfb(fb_old, fb_new + xmin + stride * ymin, xmin, xmax, ymin, ymax, stride, fb_new_orientation);
+                    }
+                }
+            }
+
+
     
-        void DiffBuffBase::_copy_rotate_0(uint16_t* fb_dest, const uint16_t* fb_src)
+        /** load 2 pixels at once (the framebuffers may only be 2-bytes aligned). */
+        static inline uint32_t _load2px(const uint16_t* p) __attribute__((always_inline));
+        static inline uint32_t _load2px(const uint16_t* p)
             {
-            memcpy(fb_dest, fb_src, sizeof(uint16_t) * DiffBuffBase::LX * DiffBuffBase::LY);
+            uint32_t v;
+            memcpy(&v, p, 4);
+            return v;
             }
 
 
-        void DiffBuffBase::_copy_rotate_90(uint16_t* fb_dest, const uint16_t* fb_src)
+        /** store 2 pixels at once (the framebuffers may only be 2-bytes aligned). */
+        static inline void _store2px(uint16_t* p, uint32_t v) __attribute__((always_inline));
+        static inline void _store2px(uint16_t* p, uint32_t v)
             {
-            uint16_t* p = fb_dest;
-            for (int i = 0; i < DiffBuffBase::LY; i++)
+            memcpy(p, &v, 4);
+            }
+
+
+        template<int DY>
+        void DiffBuffBase::_copy_transpose(uint16_t* fb_dest, const uint16_t* fb_src, int w, int h, int base, int dx)
+            {
+            for (int j0 = 0; j0 < h; j0 += COPY_TILE)
                 {
-                int j = DiffBuffBase::LX - 1;
-                while (j >= 0)
+                const int j1 = (j0 + COPY_TILE < h) ? (j0 + COPY_TILE) : h;
+                const int j2 = j0 + ((j1 - j0) & ~1); // end of the pairs of lines
+                for (int i0 = 0; i0 < w; i0 += COPY_TILE)
                     {
-                    *(p++) = fb_src[i + DiffBuffBase::LY * (j--)];
-                    *(p++) = fb_src[i + DiffBuffBase::LY * (j--)];
-                    *(p++) = fb_src[i + DiffBuffBase::LY * (j--)];
-                    *(p++) = fb_src[i + DiffBuffBase::LY * (j--)];
+                    const int i1 = (i0 + COPY_TILE < w) ? (i0 + COPY_TILE) : w;
+                    int i = i0;
+                    for (; i + 1 < i1; i += 2)
+                        { // columns i and i+1 of the destination are read from the source lines a and b
+                        const uint16_t* a = fb_src + base + dx * i;
+                        const uint16_t* b = a + dx;
+                        uint16_t* p = fb_dest + i + DiffBuffBase::LX * j0;
+                        int j = j0;
+                        for (; j < j2; j += 2, p += 2 * DiffBuffBase::LX)
+                            { // 2x2 transpose in registers: 2 word loads, 2 word stores.
+                            if (DY > 0)
+                                {
+                                const uint32_t pa = _load2px(a + j);
+                                const uint32_t pb = _load2px(b + j);
+                                _store2px(p, (pa & 0xFFFF) | (pb << 16));
+                                _store2px(p + DiffBuffBase::LX, (pa >> 16) | (pb & 0xFFFF0000));
+                                }
+                            else
+                                {
+                                const uint32_t pa = _load2px(a - j - 1);
+                                const uint32_t pb = _load2px(b - j - 1);
+                                _store2px(p, (pa >> 16) | (pb & 0xFFFF0000));
+                                _store2px(p + DiffBuffBase::LX, (pa & 0xFFFF) | (pb << 16));
+                                }
+                            }
+                        if (j < j1) { p[0] = a[DY * j]; p[1] = b[DY * j]; }
+                        }
+                    if (i < i1)
+                        { // last column when the width is odd
+                        const uint16_t* a = fb_src + base + dx * i;
+                        for (int j = j0; j < j1; j++) fb_dest[i + DiffBuffBase::LX * j] = a[DY * j];
+                        }
                     }
                 }
             }
 
 
+        void DiffBuffBase::_copy_rotate_0(uint16_t* fb_dest, const uint16_t* fb_src)
+            {
+            memcpy(fb_dest, fb_src, sizeof(uint16_t) * DiffBuffBase::LX * DiffBuffBase::LY);
+            }
+
+
+        void DiffBuffBase::_copy_rotate_90(uint16_t* fb_dest, const uint16_t* fb_src)
+            { // dest(x,y) = src[y + LY*(LX - 1 - x)]
+            _copy_transpose<1>(fb_dest, fb_src, DiffBuffBase::LX, DiffBuffBase::LY, DiffBuffBase::LY * (DiffBuffBase::LX - 1), -DiffBuffBase::LY);
+            }
+
+
         void DiffBuffBase::_copy_rotate_180(uint16_t* fb_dest, const uint16_t* fb_src)
             {
             uint16_t* p = fb_dest;
@@ -128,19 +404,8 @@ namespace ILI9488_T4
 
 
         void DiffBuffBase::_copy_rotate_270(uint16_t* fb_dest, const uint16_t* fb_src)
-            {
-            uint16_t* p = fb_dest;
-            for (int i = DiffBuffBase::LY - 1; i >= 0; i--)
-                {
-                int j = 0;
-                while (j < DiffBuffBase::LX)
-                    {
-                    *(p++) = fb_src[i + DiffBuffBase::LY * (j++)];
-                    *(p++) = fb_src[i + DiffBuffBase::LY * (j++)];
-                    *(p++) = fb_src[i + DiffBuffBase::LY * (j++)];
-                    *(p++) = fb_src[i + DiffBuffBase::LY * (j++)];
-                    }
-                }
+            { // dest(x,y) = src[(LY - 1 - y) + LY*x]
+            _copy_transpose<-1>(fb_dest, fb_src, DiffBuffBase::LX, DiffBuffBase::LY, DiffBuffBase::LY - 1, DiffBuffBase::LY);
             }
 
 
@@ -159,16 +424,8 @@ namespace ILI9488_T4
 
 
         void DiffBuffBase::_copy_rotate_90(uint16_t* fb_dest, const uint16_t* fb_src, int x1, int x2, int y1, int y2, int w, int h, int src_stride)
-            {
-            uint16_t* p = fb_dest + x1 + (DiffBuffBase::LX*y1);
-            for (int j = 0; j < h; j++)
-                {   
-                for (int i = w-1; i >= 0 ; i--)                    
-                    {
-                    *(p++) = fb_src[j + (src_stride * i)];
-                    }
-                p += (DiffBuffBase::LX - w);
-                }
+            { // dest(x1 + i, y1 + j) = src[j + src_stride*(w - 1 - i)]
+            _copy_transpose<1>(fb_dest + x1 + (DiffBuffBase::LX * y1), fb_src, w, h, src_stride * (w - 1), -src_stride);
             }
         
 
@@ -187,42 +444,84 @@ namespace ILI9488_T4
 
 
         void DiffBuffBase::_copy_rotate_270(uint16_t* fb_dest, const uint16_t* fb_src, int x1, int x2, int y1, int y2, int w, int h, int src_stride)
+            { // dest(x1 + i, y1 + j) = src[(h - 1 - j) + src_stride*i]
+            _copy_transpose<-1>(fb_dest + x1 + (DiffBuffBase::LX * y1), fb_src, w, h, h - 1, src_stride);
+            }
+
+
+        /** one step of the row checksum: mix a 32 bit word into the hash. */
+        static inline uint32_t _checksumStep(uint32_t h, uint32_t w) __attribute__((always_inline));
+        static inline uint32_t _checksumStep(uint32_t h, uint32_t w)
             {
-            uint16_t* p = fb_dest + x1 + (DiffBuffBase::LX*y1);
-            for (int j = h - 1; j >= 0; j--)
-                {   
-                for (int i = 0; i < w ; i++)   
+            h = (h ^ w) * 0x9E3779B1;
+            return ((h << 13) | (h >> 19));
+            }
+
+
+        uint32_t DiffBuffBase::rowChecksum(const uint16_t* row)
+            {
+            static_assert((DiffBuffBase::LX % 8) == 0, "LX must be divisible by 8");
+            // 4 independent lanes so that the multiplications can be pipelined.
+            uint32_t h0 = 0x811C9DC5, h1 = 0x01000193, h2 = 0x7FEB352D, h3 = 0x846CA68B;
+            for (int i = 0; i < DiffBuffBase::LX; i += 8)
+                {
+                h0 = _checksumStep(h0, _load2px(row + i));
+                h1 = _checksumStep(h1, _load2px(row + i + 2));
+                h2 = _checksumStep(h2, _load2px(row + i + 4));
+                h3 = _checksumStep(h3, _load2px(row + i + 6));
+                }
+            return _checksumStep(_checksumStep(_checksumStep(h0, h1), h2), h3);
+            }
+
+
+        void DiffBuffBase::rowChecksums(const uint16_t* fb, int fb_orientation, uint32_t* row_sums)
+            {
+            if ((fb == nullptr) || (row_sums == nullptr)) return;
+            uint16_t row[DiffBuffBase::LX]; // rotated row
+            for (int r = 0; r < DiffBuffBase::LY; r++)
+                {
+                switch (fb_orientation)
                     {
-                    *(p++) = fb_src[j + (src_stride * i)];
+                    case LANDSCAPE_480x320:
+                        for (int x = 0; x < DiffBuffBase::LX; x++) row[x] = fb[r + DiffBuffBase::LY * (DiffBuffBase::LX - 1 - x)];
+                        break;
+                    case PORTRAIT_320x480_FLIPPED:
+                        for (int x = 0; x < DiffBuffBase::LX; x++) row[x] = fb[(DiffBuffBase::LX - 1 - x) + DiffBuffBase::LX * (DiffBuffBase::LY - 1 - r)];
+                        break;
+                    case LANDSCAPE_480x320_FLIPPED:
+                        for (int x = 0; x < DiffBuffBase::LX; x++) row[x] = fb[(DiffBuffBase::LY - 1 - r) + DiffBuffBase::LY * x];
+                        break;
+                    default: // PORTRAIT_320x480: no need to copy
+                        row_sums[r] = rowChecksum(fb + DiffBuffBase::LX * r);
+                        continue;
                     }
-                p += (DiffBuffBase::LX - w);
+                row_sums[r] = rowChecksum(row);
                 }
             }
 
 
-        template<bool COPY_NEW_OVER_OLD, bool USE_MASK>
-        void DiffBuff::_computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int gap, uint16_t compare_mask)
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
+        bool DiffBuff::_computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int gap, uint16_t compare_mask, uint32_t* row_sums)
             {
             switch (fb_new_orientation)
                 {
                 case PORTRAIT_320x480:
-                    _computeDiff0<COPY_NEW_OVER_OLD, USE_MASK>(fb_old, fb_new, gap, compare_mask);
-                    return;
+                    if (row_sums) return _computeDiff0Rows<COPY_NEW_OVER_OLD, COMPARE>(fb_old, fb_new, gap, compare_mask, row_sums);
+                    _computeDiff0<COPY_NEW_OVER_OLD, COMPARE>(fb_old, fb_new, gap, compare_mask);
+                    return false;
                 case LANDSCAPE_480x320:
-                    _computeDiff1<COPY_NEW_OVER_OLD, USE_MASK>(fb_old, fb_new, gap, compare_mask);
-                    return;
+                    _computeDiff1<COPY_NEW_OVER_OLD, COMPARE>(fb_old, fb_new, gap, compare_mask);
+                    return false;
                 case PORTRAIT_320x480_FLIPPED:
-                    _computeDiff2<COPY_NEW_OVER_OLD, USE_MASK>(fb_old, fb_new, gap, compare_mask);
-                    return;
+                    _computeDiff2<COPY_NEW_OVER_OLD, COMPARE>(fb_old, fb_new, gap, compare_mask);
+                    return false;
                 case LANDSCAPE_480x320_FLIPPED:
-                    _computeDiff3<COPY_NEW_OVER_OLD, USE_MASK>(fb_old, fb_new, gap, compare_mask);
-                    return;
+                    _computeDiff3<COPY_NEW_OVER_OLD, COMPARE>(fb_old, fb_new, gap, compare_mask);
+                    return false;
                 }
             // hum...
-            return;
+            return false;
             }
-
-
        
         
 #define COMPUTE_DIFF_LOOP_SUB            {                                                       \
@@ -253,12 +552,40 @@ namespace ILI9488_T4
                                          }
 
 
+#define COMPUTE_DIFF_LOOP_TOL(INDEX)     {                                                       \
+                                         const int ind = (INDEX);                                \
+                                         if (!_sameColor(fb_old[n], fb_new[ind]))                \
+                                             COMPUTE_DIFF_LOOP_SUB                               \
+                                         else { cgap++; }                                        \
+                                         n++;                                                    \
+                                         }
+
+
+#define COMPUTE_DIFF_LOOP_HYST(INDEX)    {                                                       \
+                                         const int ind = (INDEX);                                \
+                                         if (_hystDiffer(n, fb_old[n], fb_new[ind], compare_mask)) \
+                                             COMPUTE_DIFF_LOOP_SUB                               \
+                                         else { cgap++; }                                        \
+                                         n++;                                                    \
+                                         }
+
+
 #define COMPUTE_DIFF_LOOP(INDEX)    {                                       \
-                                    if (USE_MASK)                           \
+                                    if (COMPARE == COMPARE_MASK)            \
                                         {                                   \
                                         COMPUTE_DIFF_LOOP_MASK(INDEX)       \
                                         COMPUTE_DIFF_LOOP_MASK(INDEX)       \
                                         }                                   \
+                                    else if (COMPARE == COMPARE_TOLERANCE)  \
+                                        {                                   \
+                                        COMPUTE_DIFF_LOOP_TOL(INDEX)        \
+                                        COMPUTE_DIFF_LOOP_TOL(INDEX)        \
+                                        }                                   \
+                                    else if (COMPARE == COMPARE_HYSTERESIS) \
+                                        {                                   \
+                                        COMPUTE_DIFF_LOOP_HYST(INDEX)       \
+                                        COMPUTE_DIFF_LOOP_HYST(INDEX)       \
+                                        }                                   \
                                     else                                    \
                                         {                                   \
                                         COMPUTE_DIFF_LOOP_NOMASK(INDEX)     \
@@ -277,39 +604,119 @@ namespace ILI9488_T4
                             
 
 
-        template<bool COPY_NEW_OVER_OLD, bool USE_MASK>
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
+        bool DiffBuff::_computeDiffSpan0(uint16_t* fb_old, const uint16_t* fb_new, int n, int nend, int gap, const Policy& pol, int& cgap, int& pos)
+            {
+            // with a tolerance/hysteresis, pixel pairs are first checked for strict equality (fast path for static content). 
+            const uint32_t mask32 = (COMPARE == COMPARE_MASK) ? ((((uint32_t)pol.mask) << 16) | pol.mask) : 0xFFFFFFFF;
+            while(n < nend)
+                {
+                // skip identical pixels 8 at a time (4 independent word loads/xors)
+                const uint32_t d0 = (_load2px(fb_old + n) ^ _load2px(fb_new)) & mask32;
+                const uint32_t d1 = (_load2px(fb_old + n + 2) ^ _load2px(fb_new + 2)) & mask32;
+                const uint32_t d2 = (_load2px(fb_old + n + 4) ^ _load2px(fb_new + 4)) & mask32;
+                const uint32_t d3 = (_load2px(fb_old + n + 6) ^ _load2px(fb_new + 6)) & mask32;
+                if ((d0 | d1 | d2 | d3) == 0)
+                    {
+                    n += 8;
+                    fb_new += 8;
+                    cgap += 8;
+                    continue;
+                    }
+                // boundary of a run: check the two groups of 4 pixels. 
+                for (int k = 0; k < 2; k++)
+                    {
+                    const uint32_t e0 = (k == 0) ? d0 : d2;
+                    const uint32_t e1 = (k == 0) ? d1 : d3;
+                    if ((e0 | e1) == 0)
+                        { // 4 identical pixels
+                        n += 4;
+                        fb_new += 4;
+                        cgap += 4;
+                        }
+                    else if ((COMPARE <= COMPARE_MASK) && (e0 & 0xFFFF) && (e0 >> 16) && (e1 & 0xFFFF) && (e1 >> 16))
+                        { // 4 different pixels
+                        if (COPY_NEW_OVER_OLD) { memcpy(fb_old + n, fb_new, 8); }
+                        if (cgap >= gap)
+                            {
+                            if (!_write_chunk(n - pos - cgap, cgap)) return false;
+                            pos = n;
+                            }
+                        cgap = 0;
+                        n += 4;
+                        fb_new += 4;
+                        }
+                    else
+                        { // mixed: per pixel resolution.
+                        for (int l = 0; l < 4; l++, n++, fb_new++)
+                            {
+                            if ((COMPARE == COMPARE_HYSTERESIS) ? _hystDiffer(n, fb_old[n], *fb_new, pol.mask) : 
+                                ((COMPARE == COMPARE_TOLERANCE) ? (!_sameColor(fb_old[n], *fb_new, pol.tol_r, pol.tol_g, pol.tol_b)) : (((fb_old[n] ^ *fb_new) & (uint16_t)mask32) != 0)))
+                                {
+                                if (COPY_NEW_OVER_OLD) { fb_old[n] = *fb_new; }
+                                if (cgap >= gap)
+                                    {
+                                    if (!_write_chunk(n - pos - cgap, cgap)) return false;
+                                    pos = n;
+                                    }
+                                cgap = 0;
+                                }
+                            else { cgap++; }
+                            }
+                        }
+                    }
+                }
+            return true;
+            }
+
+
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
         void DiffBuff::_computeDiff0(uint16_t* fb_old, const uint16_t* fb_new, int gap, uint16_t compare_mask)
             {
+            static_assert(((DiffBuffBase::LX * DiffBuffBase::LY) % 8) == 0, "number of pixels must be a multiple of 8");
             int cgap = 0;   // current gap size;
             int pos = 0;    // number of pixel written in diffbuf
-            int n = 0;      // current offset  
-            int m = 0; 
-            while(m < DiffBuffBase::LX*DiffBuffBase::LY)
-                {
-                COMPUTE_DIFF_LOOP((m++)) 
-                }
+            const Policy pol = _globalPolicy(compare_mask);
+            if (!_computeDiffSpan0<COPY_NEW_OVER_OLD, COMPARE>(fb_old, fb_new, 0, DiffBuffBase::LX * DiffBuffBase::LY, gap, pol, cgap, pos)) return;
             COMPUTE_DIFF_END
             }
 
-        template<bool COPY_NEW_OVER_OLD, bool USE_MASK>
-        void DiffBuff::_computeDiff1(uint16_t* fb_old, const uint16_t* fb_new, int gap, uint16_t compare_mask)
+
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
+        bool DiffBuff::_computeDiff0Rows(uint16_t* fb_old, const uint16_t* fb_new, int gap, uint16_t compare_mask, uint32_t* row_sums)
             {
             int cgap = 0;   // current gap size;
             int pos = 0;    // number of pixel written in diffbuf
-            int n = 0;      // current offset  
-            for (int i = 0; i < DiffBuffBase::LY; i++)
+            int nbskipped = 0; // number of rows skipped
+            const Policy pol = _globalPolicy(compare_mask);
+            for (int j = 0; j < DiffBuffBase::LY; j++)
                 {
-                int j = DiffBuffBase::LX - 1;
-                while (j >= 0)
-                    {
-                    COMPUTE_DIFF_LOOP((i + DiffBuffBase::LY * (j--)))
+                const int n = DiffBuffBase::LX * j;
+                const uint32_t h = rowChecksum(fb_new + n);
+                if (h == row_sums[j])
+                    { // same checksum: the row is unchanged, no need to read fb_old
+                    cgap += DiffBuffBase::LX;
+                    nbskipped++;
+                    continue;
                     }
+                if (!_computeDiffSpan0<COPY_NEW_OVER_OLD, COMPARE>(fb_old, fb_new + n, n, n + DiffBuffBase::LX, gap, pol, cgap, pos)) return false;
+                // with a mask/tolerance, only the pixels that differ are copied so fb_old may not be equal to fb_new. 
+                row_sums[j] = (COPY_NEW_OVER_OLD && (COMPARE != COMPARE_EXACT)) ? rowChecksum(fb_old + n) : h;
                 }
             COMPUTE_DIFF_END
+            _stats_rows_skipped.push(nbskipped);
+            return true;
+            }
+
+
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
+        void DiffBuff::_computeDiff1(uint16_t* fb_old, const uint16_t* fb_new, int gap, uint16_t compare_mask)
+            { // pixel (x,y) <- fb_new[y + LY*(LX - 1 - x)]
+            _computeDiffBlocked<COPY_NEW_OVER_OLD, COMPARE>(fb_old, fb_new, DiffBuffBase::LY * (DiffBuffBase::LX - 1), -DiffBuffBase::LY, 1, gap, compare_mask);
             }
 
 
-        template<bool COPY_NEW_OVER_OLD, bool USE_MASK>
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
         void DiffBuff::_computeDiff2(uint16_t* fb_old, const uint16_t* fb_new, int gap, uint16_t compare_mask)
             {
             int cgap = 0;   // current gap size;
@@ -328,18 +735,72 @@ namespace ILI9488_T4
             }
 
 
-        template<bool COPY_NEW_OVER_OLD, bool USE_MASK>
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
         void DiffBuff::_computeDiff3(uint16_t* fb_old, const uint16_t* fb_new, int gap, uint16_t compare_mask)
+            { // pixel (x,y) <- fb_new[(LY - 1 - y) + LY*x]
+            _computeDiffBlocked<COPY_NEW_OVER_OLD, COMPARE>(fb_old, fb_new, DiffBuffBase::LY - 1, DiffBuffBase::LY, -1, gap, compare_mask);
+            }
+
+
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
+        void DiffBuff::_computeDiffBlocked(uint16_t* fb_old, const uint16_t* fb_new, int base, int dx, int dy, int gap, uint16_t compare_mask)
             {
+            static_assert(((DiffBuffBase::LX % DIFF_TILE) == 0) && ((DiffBuffBase::LY % DIFF_TILE) == 0), "LX and LY must be multiples of DIFF_TILE");
+            const int NW = (DiffBuffBase::LX + 31) / 32;  // number of flag words per line
+            const uint16_t cmask = (COMPARE == COMPARE_EXACT) ? 0xFFFF : compare_mask;
+            uint32_t flags[DIFF_TILE][NW]; // pixels that differ in the current band
             int cgap = 0;   // current gap size;
             int pos = 0;    // number of pixel written in diffbuf
-            int n = 0;      // current offset  
-            for (int i = DiffBuffBase::LY - 1; i >= 0; i--)
+            for (int y0 = 0; y0 < DiffBuffBase::LY; y0 += DIFF_TILE)
                 {
-                int j = 0;
-                while (j < DiffBuffBase::LX)
+                // pass 1: compare the band tile by tile. Inside a tile, fb_new is read along its own lines
+                // and the DIFF_TILE lines of fb_old touched stay in cache.
+                memset(flags, 0, sizeof(flags));
+                for (int x0 = 0; x0 < DiffBuffBase::LX; x0 += DIFF_TILE)
+                    {
+                    for (int x = x0; x < x0 + DIFF_TILE; x++)
+                        {
+                        const uint16_t* src = fb_new + base + dx * x + dy * y0;
+                        int n = x + DiffBuffBase::LX * y0;
+                        uint32_t* fl = &(flags[0][x >> 5]);
+                        const uint32_t bit = 1u << (x & 31);
+                        for (int t = 0; t < DIFF_TILE; t++, src += dy, n += DiffBuffBase::LX, fl += NW)
+                            {
+                            const uint16_t c = *src;
+                            if (_differ<COMPARE>(n, fb_old[n], c, cmask))
+                                {
+                                if (COPY_NEW_OVER_OLD) { fb_old[n] = c; }
+                                *fl |= bit;
+                                }
+                            }
+                        }
+                    }
+                // pass 2: emit the runs of the band in orientation 0 order.
+                for (int t = 0; t < DIFF_TILE; t++)
                     {
-                    COMPUTE_DIFF_LOOP((i + DiffBuffBase::LY * (j++)))
+                    int n = DiffBuffBase::LX * (y0 + t);
+                    for (int w = 0; w < NW; w++, n += 32)
+                        {
+                        const int wb = ((DiffBuffBase::LX - 32 * w) < 32) ? (DiffBuffBase::LX - 32 * w) : 32; // pixels in this word
+                        uint32_t b = flags[t][w];
+                        if (b == 0) { cgap += wb; continue; } // fast path: no change
+                        int k = 0;
+                        while (b)
+                            {
+                            const int z = __builtin_ctz(b); // next differing pixel
+                            cgap += z;
+                            k += z;
+                            if (cgap >= gap)
+                                {
+                                if (!_write_chunk(n + k - pos - cgap, cgap)) return;
+                                pos = n + k;
+                                }
+                            cgap = 0;
+                            b = (b >> z) >> 1;
+                            k++;
+                            }
+                        cgap += wb - k;
+                        }
                     }
                 }
             COMPUTE_DIFF_END
@@ -349,51 +810,153 @@ namespace ILI9488_T4
 #undef COMPUTE_DIFF_LOOP_SUB
 #undef COMPUTE_DIFF_LOOP_MASK
 #undef COMPUTE_DIFF_LOOP_NOMASK
+#undef COMPUTE_DIFF_LOOP_TOL
+#undef COMPUTE_DIFF_LOOP_HYST
 #undef COMPUTE_DIFF_LOOP
 #undef COMPUTE_DIFF_END
 
 
-        void DiffBuff::computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int gap, bool copy_new_over_old, uint16_t compare_mask)
+        void DiffBuff::computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int gap, bool copy_new_over_old, uint16_t compare_mask, uint32_t* row_sums)
             {
             elapsedMicros em; // for stats. 
             if (gap < 1) gap = 1;
             if ((fb_new_orientation < 0) || (fb_new_orientation > 3)) fb_new_orientation = 0;
-            _posw = 0; // reset buffer
+            _init_write(gap); // reset buffer
             if ((_sizebuf <= 0) || (fb_old == nullptr) || (fb_new == nullptr))
                 {
-                _write_encoded(TAG_END);
+                _end_write();
                 _posw = 0;
 //                initRead();
                 return;
                 }
-            if ((compare_mask != 0) && (compare_mask != 0xffff))
+            bool sums_ok; // true if row_sums was updated during the diff
+            if (_nb_regions > 0)
+                { // compare regions: each line is split in segments with a constant comparison policy.
+                const Rect full = { 0, DiffBuffBase::LX - 1, 0, DiffBuffBase::LY - 1 };
+                const Policy global = _globalPolicy(compare_mask);
+                if (_hyst) _hyst->_startFrame();
+                int cgap = 0, pos = 0, cur = 0;
+                const bool ok = (copy_new_over_old) ? _computeDiffRects<true>(fb_old, fb_new, fb_new_orientation, &full, 1, 0, DiffBuffBase::LY - 1, gap, global, cgap, pos, cur)
+                                                    : _computeDiffRects<false>(fb_old, fb_new, fb_new_orientation, &full, 1, 0, DiffBuffBase::LY - 1, gap, global, cgap, pos, cur);
+                if (ok) _endDiffRects(cgap, pos, cur);
+                sums_ok = false;
+                }
+            else if (_hyst)
                 {
+                if ((compare_mask == 0) || (compare_mask == 0xffff)) compare_mask = 0xFFFF;
+                _hyst->_startFrame();
                 if (copy_new_over_old) 
-                    _computeDiff<true, true>(fb_old, fb_new, fb_new_orientation, gap, compare_mask);
+                    sums_ok = _computeDiff<true, COMPARE_HYSTERESIS>(fb_old, fb_new, fb_new_orientation, gap, compare_mask, row_sums);
                 else
-                    _computeDiff<false, true>(fb_old, fb_new, fb_new_orientation, gap, compare_mask);
+                    sums_ok = _computeDiff<false, COMPARE_HYSTERESIS>(fb_old, fb_new, fb_new_orientation, gap, compare_mask, row_sums);
+                }
+            else if (_use_tol)
+                {
+                if (copy_new_over_old) 
+                    sums_ok = _computeDiff<true, COMPARE_TOLERANCE>(fb_old, fb_new, fb_new_orientation, gap, compare_mask, row_sums);
+                else
+                    sums_ok = _computeDiff<false, COMPARE_TOLERANCE>(fb_old, fb_new, fb_new_orientation, gap, compare_mask, row_sums);
+                }
+            else if ((compare_mask != 0) && (compare_mask != 0xffff))
+                {
+                if (copy_new_over_old) 
+                    sums_ok = _computeDiff<true, COMPARE_MASK>(fb_old, fb_new, fb_new_orientation, gap, compare_mask, row_sums);
+                else
+                    sums_ok = _computeDiff<false, COMPARE_MASK>(fb_old, fb_new, fb_new_orientation, gap, compare_mask, row_sums);
                 }
             else
                 {
                 if (copy_new_over_old)
-                    _computeDiff<true, false>(fb_old, fb_new, fb_new_orientation, gap, compare_mask);
+                    sums_ok = _computeDiff<true, COMPARE_EXACT>(fb_old, fb_new, fb_new_orientation, gap, compare_mask, row_sums);
                 else
-                    _computeDiff<false, false>(fb_old, fb_new, fb_new_orientation, gap, compare_mask);
+                    sums_ok = _computeDiff<false, COMPARE_EXACT>(fb_old, fb_new, fb_new_orientation, gap, compare_mask, row_sums);
                 }
 
-            _write_encoded(TAG_END);
-            if ((unsigned int)size() >= (unsigned int)_sizebuf)
+            _flush_chunk();
+            _end_write();
+            if (_overflow)
                 { // diff is full so copy from new to old may not have been completed...
                 if (copy_new_over_old) copyfb(fb_old, fb_new, fb_new_orientation); // copy again. 
+                sums_ok = false;
                 }
+            if (!sums_ok) _updateRowChecksums(fb_old, fb_new, fb_new_orientation, copy_new_over_old, row_sums);
+            if (_hyst) _hyst->_endFrame();
 //            initRead();
             // done. record stats
             _stats_size.push(size());
-            if ((unsigned int)size() >= (unsigned int)_sizebuf) _stat_overflow++;
+            if (_overflow) _stat_overflow++;
+            if (_max_gap > _gap)
+                {
+                _stat_coalesced++;
+                _stats_gap.push(_max_gap);
+                }
             _stats_time.push(em);
             }
 
 
+        void DiffBuff::_buildRowIndex()
+            {
+            _row_index_valid = false;
+            if (_row_index == nullptr) return;
+            const int N = DiffBuffBase::LX * DiffBuffBase::LY;
+            const int R = DiffBuffBase::LX * _row_index_rows; // number of pixels per entry
+            const int nbe = rowIndexSize(_row_index_rows);
+            int pos = 0, off = 0, e = 0;
+            while (e < nbe)
+                {
+                const int p0 = pos;
+                uint32_t w, sk;
+                _read_chunk(pos, w, sk);
+                if ((w == TAG_END) || (w == TAG_WRITE_ALL) || (off >= N))
+                    { // the remaining bands start here (TAG_WRITE_ALL writes everything from the current offset)
+                    for (; e < nbe; e++)
+                        {
+                        _row_index[e].pos = p0;
+                        _row_index[e].off = ((w == TAG_WRITE_ALL) && (e * R > off)) ? (e * R) : off;
+                        }
+                    break;
+                    }
+                // this chunk is the first one for every band starting before the end of its write part. 
+                for (; (e < nbe) && (e * R < off + (int)w); e++)
+                    {
+                    _row_index[e].pos = p0;
+                    _row_index[e].off = off;
+                    }
+                off += w + sk;
+                }
+            _row_index_valid = true;
+            }
+
+
+        bool DiffBuff::seekRow(int row)
+            {
+            if ((_row_index == nullptr) || (!_row_index_valid)) return false;
+            if (row < 0) row = 0; else if (row >= DiffBuffBase::LY) row = DiffBuffBase::LY - 1;
+            const int b = row / _row_index_rows;
+            const RowIndexEntry& e = _row_index[b];
+            _initReadWindow();
+            _r_cont = false;
+            _posr = e.pos;
+            _off = e.off;
+            const int start = b * _row_index_rows * DiffBuffBase::LX; // first pixel of the band
+            if (_off >= start) return true; // the chunk starts inside the band
+            // the write part of the chunk crosses the band limit: load it and cut it there. 
+            uint32_t w, sk;
+            int pos = _posr;
+            _read_chunk(pos, w, sk);
+            if (w == TAG_END) return true;
+            const int end = (w == TAG_WRITE_ALL) ? (DiffBuffBase::LX * DiffBuffBase::LY) : (_off + (int)w);
+            if (end <= start) return true; // cannot happen with a valid index. 
+            _posr = pos;
+            _r_y = start / DiffBuffBase::LX;
+            _r_x = start - (DiffBuffBase::LX * _r_y);
+            _r_len = end - start;
+            _off = end + sk;
+            _r_cont = true;
+            return true;
+            }
+
+
         int DiffBuff::readDiff(int& x, int& y, int& len, int scanline)
             {
             if (!_r_cont)
@@ -401,9 +964,16 @@ namespace ILI9488_T4
                 int nb_write, nb_skip;
                 while(1)
                     {
-                    nb_write = _read_encoded(_posr);         // number of pixel to write
-                    if (nb_write == TAG_END) return -1; // done !
-                    if (nb_write == TAG_WRITE_ALL)
+                    if (_posr >= _posw_pub)
+                        { // diff computed by bands: this part is not available yet. 
+                        len = 0;
+                        return scanline + 1;
+                        }
+                    std::atomic_signal_fence(std::memory_order_acquire);
+                    uint32_t w, sk;
+                    _read_chunk(_posr, w, sk);          // number of pixels to write / skip
+                    if (w == TAG_END) return -1; // done !
+                    if (w == TAG_WRITE_ALL)
                         { // must write everything
                         nb_write = DiffBuffBase::LX * DiffBuffBase::LY - _off;
                         nb_skip = 0;
@@ -411,7 +981,8 @@ namespace ILI9488_T4
                         }
                     else
                         {
-                        nb_skip = _read_encoded(_posr);      // number of pixels to skip
+                        nb_write = (int)w;
+                        nb_skip = (int)sk;
                         }
                     if (nb_write > 0) break;
                     _off += nb_skip;
@@ -423,44 +994,7 @@ namespace ILI9488_T4
                 _r_cont = true;
                 }            
             // we have a valid instruction in _r_x, _r_y, _r_len and _r_cont=true            
-            x = _r_x;
-            y = _r_y;
-            if ((scanline < DiffBuffBase::LY) && (_r_y + MIN_SCANLINE_SPACE > scanline))
-                { // we must wait a bit.
-                len = 0;
-                const int l = _r_y + MIN_SCANLINE_SPACE;
-                return ((l < DiffBuffBase::LY) ? l : DiffBuffBase::LY);
-                }
-            if (_r_x > 0)
-                { // not at the beginning of a line. 
-                if (_r_x + _r_len <= DiffBuffBase::LX)
-                    { // everything fits on the line
-                    len = _r_len;
-                    _r_cont = false;
-                    return 0;
-                    }
-                len = DiffBuffBase::LX - _r_x;
-                _r_len -= len; 
-                _r_x = 0;
-                _r_y++;
-                return 0;
-                }
-            // at the beginning of a line 
-            int maxl = scanline - _r_y; // max number of lines available now
-            if (maxl > MAX_WRITE_LINE) maxl = MAX_WRITE_LINE; // clamp at max value. 
-            const int nbw = maxl * DiffBuffBase::LX; // max number of pixels that we can write 
-            if (_r_len <= nbw)
-                { // ok, we can write everything now
-                len = _r_len;
-                _r_cont = false;
-                return 0;
-                }
-            // cannot write everything yet. 
-            len = nbw;
-            _r_len -= nbw;
-            _r_x = 0;
-            _r_y += maxl;
-            return 0;
+            return _splitRun(_r_x, _r_y, _r_len, _r_cont, x, y, len, scanline);
             }
 
 
@@ -470,10 +1004,10 @@ namespace ILI9488_T4
             elapsedMicros em; // for stats. 
             if (gap < 1) gap = 1;
             if ((fb_new_orientation < 0) || (fb_new_orientation > 3)) fb_new_orientation = 0;
-            _posw = 0; // reset buffer
+            _init_write(gap); // reset buffer
             if ((_sizebuf <= 0) || (fb_old == nullptr) || (sub_fb_new == nullptr))
                 {
-                _write_encoded(TAG_END);
+                _end_write();
                 _posw = 0;
 //                initRead();
                 return;
@@ -484,15 +1018,21 @@ namespace ILI9488_T4
 
             _computeDiff(fb_old, diff_old, sub_fb_new, x1, x2, y1, y2, stride, fb_new_orientation, gap, copy_new_over_old, compare_mask);
 
-            _write_encoded(TAG_END);
-            if ((unsigned int)size() >= (unsigned int)_sizebuf)
+            _flush_chunk();
+            _end_write();
+            if (_overflow)
                 { // diff is full so copy from new to old may not have been completed...
                 if (copy_new_over_old) copyfb(fb_old, sub_fb_new, xmin, xmax, ymin, ymax, stride, fb_new_orientation); // copy again. 
                 }
             // done. record stats
 //            initRead();
             _stats_size.push(size());
-            if ((unsigned int)size() >= (unsigned int)_sizebuf) _stat_overflow++;
+            if (_overflow) _stat_overflow++;
+            if (_max_gap > _gap)
+                {
+                _stat_coalesced++;
+                _stats_gap.push(_max_gap);
+                }
             _stats_time.push(em);
             }
 
@@ -512,6 +1052,8 @@ namespace ILI9488_T4
                 }
  
             if (compare_mask == 0) compare_mask = 0xFFFF;
+            Policy pol = _globalPolicy(compare_mask);
+            pol.compare = (_use_tol) ? COMPARE_TOLERANCE : ((compare_mask != 0xFFFF) ? COMPARE_MASK : COMPARE_EXACT); // no hysteresis here
             int nb_write = 0, nb_skip = 0; // number of pixel to write / skip in the old diff
             diff_old->readRaw(nb_write, nb_skip);
 
@@ -630,46 +1172,40 @@ namespace ILI9488_T4
                     break;
                     }
 
-                if (nb_write + nb_skip == 0) diff_old->readRaw(nb_write, nb_skip); // reload if needed
-
-                const int nend = xmax + (DiffBuffBase::LX * yc);
-                for (int n = xmin + (DiffBuffBase::LX * yc); n <= nend; n++, m += mdelta)
+                // follow the runs of the old diff inside the region. 
+                int n = xmin + (DiffBuffBase::LX * yc);
+                const int nend = xmax + 1 + (DiffBuffBase::LX * yc);
+                while (n < nend)
                     {
-                    if (((fb_old[n]) ^ (sub_fb_new[m])) & compare_mask)
-                        {
-                        if (copy_new_over_old) 
-                            { 
-                            fb_old[n] = sub_fb_new[m]; 
-                            }
+                    if (nb_write > 0)
+                        { // pixels written anyway: just copy them. 
+                        const int l = (nb_write < nend - n) ? nb_write : (nend - n);
                         if (cgap >= gap)
                             {
                             if (!_write_chunk(n - prv - cgap, cgap)) return;
                             prv = n;
                             }
                         cgap = 0;
-                        if (nb_write > 0) nb_write--;
-                        else
+                        if (copy_new_over_old)
                             {
-                            nb_skip--;
-                            if (nb_skip == 0) diff_old->readRaw(nb_write, nb_skip); // reload if needed
+                            if (mdelta == 1) memcpy(fb_old + n, sub_fb_new + m, 2 * l);
+                            else for (int i = 0; i < l; i++) { fb_old[n + i] = sub_fb_new[m + i * mdelta]; }
                             }
+                        nb_write -= l;
+                        n += l;
+                        m += l * mdelta;
                         }
-                    else if (nb_write > 0)
-                        { // same pixel, nb_write > 0
-                        if (cgap >= gap)
-                            {
-                            if (!_write_chunk(n - prv - cgap, cgap)) return;
-                            prv = n;
-                            }
-                        cgap = 0;
-                        nb_write--;
-                        }
-                    else
-                        { // same pixel, nb_write=0 and nb_skip>0
-                        cgap++;
-                        nb_skip--;
-                        if (nb_skip == 0) diff_old->readRaw(nb_write, nb_skip); // reload if needed
+                    else if (nb_skip > 0)
+                        { // pixels skipped by the old diff: compare them. 
+                        const int l = (nb_skip < nend - n) ? nb_skip : (nend - n);
+                        const bool ok = (copy_new_over_old) ? _computeDiffRun<true>(pol, fb_old, sub_fb_new, n, n + l, m, mdelta, gap, cgap, prv)
+                                                            : _computeDiffRun<false>(pol, fb_old, sub_fb_new, n, n + l, m, mdelta, gap, cgap, prv);
+                        if (!ok) return;
+                        nb_skip -= l;
+                        n += l;
+                        m += l * mdelta;
                         }
+                    else diff_old->readRaw(nb_write, nb_skip);
                     }
 
                 xc = xmax + 1;  
@@ -771,11 +1307,435 @@ namespace ILI9488_T4
             }
 
 
+        void DiffBuff::computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, const Rect* dirty, int nb_dirty, int gap, bool copy_new_over_old, uint16_t compare_mask)
+            {
+            elapsedMicros em; // for stats. 
+            if (gap < 1) gap = 1;
+            if ((fb_new_orientation < 0) || (fb_new_orientation > 3)) fb_new_orientation = 0;
+            _init_write(gap); // reset buffer
+            if ((_sizebuf <= 0) || (fb_old == nullptr) || (fb_new == nullptr))
+                {
+                _end_write();
+                _posw = 0;
+                return;
+                }
+
+            Rect boxes[MAX_DIRTY_RECTS];
+            const int nb_boxes = _rotateRects(fb_new_orientation, dirty, nb_dirty, boxes);
+
+            const Policy global = _globalPolicy(compare_mask);
+            if (_hyst) _hyst->_startFrame();
+            int cgap = 0, pos = 0, cur = 0;
+            const bool ok = (copy_new_over_old) ? _computeDiffRects<true>(fb_old, fb_new, fb_new_orientation, boxes, nb_boxes, 0, DiffBuffBase::LY - 1, gap, global, cgap, pos, cur)
+                                                : _computeDiffRects<false>(fb_old, fb_new, fb_new_orientation, boxes, nb_boxes, 0, DiffBuffBase::LY - 1, gap, global, cgap, pos, cur);
+            if (ok) _endDiffRects(cgap, pos, cur);
+
+            _flush_chunk();
+            _end_write();
+            if (_overflow)
+                { // diff is full so copy from new to old may not have been completed...
+                if (copy_new_over_old) copyfb(fb_old, fb_new, fb_new_orientation, dirty, nb_dirty); // copy again. 
+                }
+            if (_hyst) _hyst->_endFrame();
+            // done. record stats
+            _stats_size.push(size());
+            if (_overflow) _stat_overflow++;
+            if (_max_gap > _gap)
+                {
+                _stat_coalesced++;
+                _stats_gap.push(_max_gap);
+                }
+            _stats_time.push(em);
+            }
+
+
+        bool DiffBuff::beginDiffBands(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int gap, uint16_t compare_mask)
+            {
+            if ((_sizebuf <= 0) || (fb_old == nullptr) || (fb_new == nullptr) || (_hyst)) return false; // use computeDiff() 
+            if (gap < 1) gap = 1;
+            if ((fb_new_orientation < 0) || (fb_new_orientation > 3)) fb_new_orientation = 0;
+            _init_write(gap);
+            _b_fb_old = fb_old;
+            _b_fb_new = fb_new;
+            _b_orientation = fb_new_orientation;
+            _b_policy = _globalPolicy(compare_mask);
+            _b_y = 0;
+            _b_cgap = 0;
+            _b_pos = 0;
+            _b_cur = 0;
+            _b_nbpub = 0;
+            _b_time = 0;
+            _posw_pub = 0; // nothing to read yet
+            return true;
+            }
+
+
+        int DiffBuff::computeDiffBand(int nb_rows)
+            {
+            if (_posw_pub == PUB_ALL) return -1; // not computing by bands. 
+            elapsedMicros em; // for stats. 
+            if (nb_rows < 1) nb_rows = 1;
+            const int ymax = (_b_y + nb_rows < DiffBuffBase::LY) ? (_b_y + nb_rows - 1) : (DiffBuffBase::LY - 1);
+            if (!_overflow)
+                {
+                const Rect full = { 0, DiffBuffBase::LX - 1, 0, DiffBuffBase::LY - 1 };
+                if ((_computeDiffRects<true>(_b_fb_old, _b_fb_new, _b_orientation, &full, 1, _b_y, ymax, _gap, _b_policy, _b_cgap, _b_pos, _b_cur)) && (ymax < DiffBuffBase::LY - 1))
+                    { // end the current run at the end of the band and publish everything up to there. 
+                    if ((_b_cur - _b_pos - _b_cgap > 0) && (_write_chunk(_b_cur - _b_pos - _b_cgap, _b_cgap)))
+                        {
+                        _b_pos = _b_cur;
+                        _b_cgap = 0;
+                        }
+                    _flush_chunk();
+                    if (!_overflow) 
+                        { // TAG_WRITE_ALL is only published once fb_old is complete. 
+                        std::atomic_signal_fence(std::memory_order_release);
+                        _posw_pub = _posw;
+                        _b_nbpub = _nbwritten;
+                        }
+                    }
+                }
+            _b_y = ymax + 1;
+            _b_time += (uint32_t)em;
+            if (_b_y < DiffBuffBase::LY) return _b_nbpub;
+
+            // last band: complete the diff.
+            elapsedMicros em2;
+            if (!_overflow) _endDiffRects(_b_cgap, _b_pos, _b_cur);
+            _flush_chunk();
+            _end_write();
+            if (_overflow) copyfb(_b_fb_old, _b_fb_new, _b_orientation); // copy again. 
+            std::atomic_signal_fence(std::memory_order_release);
+            _posw_pub = PUB_ALL;
+            // done. record stats
+            _b_time += (uint32_t)em2;
+            _stats_size.push(size());
+            if (_overflow) _stat_overflow++;
+            if (_max_gap > _gap)
+                {
+                _stat_coalesced++;
+                _stats_gap.push(_max_gap);
+                }
+            _stats_time.push(_b_time);
+            return -1;
+            }
+
+
+        void DiffBuff::merge(DiffBuffBase* a, DiffBuffBase* b, int gap)
+            {
+            elapsedMicros em; // for stats. 
+            if (gap < 1) gap = 1;
+            _init_write(gap); // reset buffer
+            if ((_sizebuf <= 0) || (a == nullptr) || (b == nullptr) || (a == this) || (b == this))
+                {
+                _end_write();
+                _posw = 0;
+                return;
+                }
+            a->initRaw();
+            b->initRaw();
+            const int targetpos = DiffBuffBase::LX * DiffBuffBase::LY;
+            int wa = 0, sa = 0; // remaining write/skip of the current instruction of a
+            int wb = 0, sb = 0; // and of b
+            int cgap = 0;       // current gap size
+            int prv = 0;        // number of pixels written in the diff
+            int cur = 0;        // current position
+            while (cur < targetpos)
+                {
+                if (wa + sa == 0) { a->readRaw(wa, sa); continue; } // TAG_END/TAG_WRITE_ALL are clipped below
+                if (wb + sb == 0) { b->readRaw(wb, sb); continue; }
+                // length of the next span where the state of both diffs is constant. 
+                int la = (wa > 0) ? wa : sa;
+                const int lb = (wb > 0) ? wb : sb;
+                if (lb < la) la = lb;
+                if (targetpos - cur < la) la = targetpos - cur;
+                if ((wa > 0) || (wb > 0))
+                    { // written by one of the diffs
+                    if (cgap >= gap)
+                        {
+                        if (!_write_chunk(cur - prv - cgap, cgap)) break;
+                        prv = cur;
+                        }
+                    cgap = 0;
+                    }
+                else cgap += la;
+                cur += la;
+                if (wa > 0) wa -= la; else sa -= la;
+                if (wb > 0) wb -= la; else sb -= la;
+                }
+            if ((!_overflow) && (targetpos - prv - cgap != 0))
+                {
+                _write_chunk(targetpos - prv - cgap, cgap);
+                }
+            _flush_chunk();
+            _end_write();
+            // done. record stats
+            _stats_size.push(size());
+            if (_overflow) _stat_overflow++;
+            if (_max_gap > _gap)
+                {
+                _stat_coalesced++;
+                _stats_gap.push(_max_gap);
+                }
+            _stats_time.push(em);
+            }
+
+
+        int DiffBuff::_rotateRects(int fb_new_orientation, const Rect* dirty, int nb_dirty, Rect* boxes)
+            {
+            int nb = 0;
+            for (int k = 0; k < nb_dirty; k++)
+                {
+                int xmin, xmax, ymin, ymax;
+                if (!_clipRect(fb_new_orientation, dirty[k], xmin, xmax, ymin, ymax)) continue;
+                Rect b;
+                DiffBuffBase::rotationBox(fb_new_orientation, xmin, xmax, ymin, ymax, b.xmin, b.xmax, b.ymin, b.ymax);
+                if (nb < MAX_DIRTY_RECTS)
+                    {
+                    boxes[nb++] = b;
+                    }
+                else
+                    { // too many rectangles: merge with the last one. 
+                    Rect& l = boxes[MAX_DIRTY_RECTS - 1];
+                    if (b.xmin < l.xmin) l.xmin = b.xmin;
+                    if (b.xmax > l.xmax) l.xmax = b.xmax;
+                    if (b.ymin < l.ymin) l.ymin = b.ymin;
+                    if (b.ymax > l.ymax) l.ymax = b.ymax;
+                    }
+                }
+            return nb;
+            }
+
+
+        void DiffBuff::setCompareRegion(int index, const Rect* region, uint16_t compare_mask, int tol_red, int tol_green, int tol_blue)
+            {
+            if ((index < 0) || (index >= MAX_COMPARE_REGIONS)) return;
+            _reg_on[index] = (region != nullptr);
+            if (region)
+                {
+                _reg_rect[index] = *region;
+                Policy& pol = _reg_pol[index];
+                pol.tol_r = (tol_red < 0) ? 0 : ((tol_red > 31) ? 31 : tol_red);
+                pol.tol_g = (tol_green < 0) ? 0 : ((tol_green > 63) ? 63 : tol_green);
+                pol.tol_b = (tol_blue < 0) ? 0 : ((tol_blue > 31) ? 31 : tol_blue);
+                pol.mask = 0xFFFF;
+                if ((pol.tol_r | pol.tol_g | pol.tol_b) != 0)
+                    pol.compare = COMPARE_TOLERANCE;
+                else if ((compare_mask != 0) && (compare_mask != 0xffff))
+                    {
+                    pol.compare = COMPARE_MASK;
+                    pol.mask = compare_mask;
+                    }
+                else
+                    pol.compare = COMPARE_EXACT;
+                }
+            _nb_regions = 0;
+            for (int k = 0; k < MAX_COMPARE_REGIONS; k++) { if (_reg_on[k]) _nb_regions++; }
+            }
+
+
+        DiffBuff::Policy DiffBuff::_globalPolicy(uint16_t compare_mask) const
+            {
+            Policy pol;
+            pol.tol_r = _tol_r;
+            pol.tol_g = _tol_g;
+            pol.tol_b = _tol_b;
+            pol.mask = ((compare_mask == 0) || (compare_mask == 0xffff)) ? 0xFFFF : compare_mask;
+            if (_hyst) 
+                pol.compare = COMPARE_HYSTERESIS;
+            else if (_use_tol) 
+                pol.compare = COMPARE_TOLERANCE;
+            else if (pol.mask != 0xFFFF) 
+                pol.compare = COMPARE_MASK;
+            else
+                pol.compare = COMPARE_EXACT;
+            if (pol.compare == COMPARE_TOLERANCE) pol.mask = 0xFFFF;
+            return pol;
+            }
+
+
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
+        bool DiffBuff::_computeDiffPixels(uint16_t* fb_old, const uint16_t* fb_new, int n, int nend, int m, int mdelta, int gap, const Policy& pol, int& cgap, int& pos)
+            {
+            for (; n < nend; n++, m += mdelta)
+                {
+                if (_differ<COMPARE>(n, fb_old[n], fb_new[m], pol))
+                    {
+                    if (COPY_NEW_OVER_OLD) { fb_old[n] = fb_new[m]; }
+                    if (cgap >= gap)
+                        {
+                        if (!_write_chunk(n - pos - cgap, cgap)) return false;
+                        pos = n;
+                        }
+                    cgap = 0;
+                    }
+                else { cgap++; }
+                }
+            return true;
+            }
+
+
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
+        bool DiffBuff::_computeDiffRun(uint16_t* fb_old, const uint16_t* fb_new, int n, int nend, int m, int mdelta, int gap, const Policy& pol, int& cgap, int& pos)
+            {
+            if (mdelta != 1) return _computeDiffPixels<COPY_NEW_OVER_OLD, COMPARE>(fb_old, fb_new, n, nend, m, mdelta, gap, pol, cgap, pos);
+            // contiguous source: unaligned head and tail pixel by pixel, word kernel in between. 
+            const int n8 = (((n + 7) & ~7) < nend) ? ((n + 7) & ~7) : nend;
+            if (!_computeDiffPixels<COPY_NEW_OVER_OLD, COMPARE>(fb_old, fb_new, n, n8, m, 1, gap, pol, cgap, pos)) return false;
+            const int e8 = n8 + ((nend - n8) & ~7);
+            if (!_computeDiffSpan0<COPY_NEW_OVER_OLD, COMPARE>(fb_old, fb_new + m + (n8 - n), n8, e8, gap, pol, cgap, pos)) return false;
+            return _computeDiffPixels<COPY_NEW_OVER_OLD, COMPARE>(fb_old, fb_new, e8, nend, m + (e8 - n), 1, gap, pol, cgap, pos);
+            }
+
+
+        template<bool COPY_NEW_OVER_OLD>
+        bool DiffBuff::_computeDiffRun(const Policy& pol, uint16_t* fb_old, const uint16_t* fb_new, int n, int nend, int m, int mdelta, int gap, int& cgap, int& pos)
+            {
+            switch (pol.compare)
+                {
+            case COMPARE_TOLERANCE:
+                return _computeDiffRun<COPY_NEW_OVER_OLD, COMPARE_TOLERANCE>(fb_old, fb_new, n, nend, m, mdelta, gap, pol, cgap, pos);
+            case COMPARE_MASK:
+                return _computeDiffRun<COPY_NEW_OVER_OLD, COMPARE_MASK>(fb_old, fb_new, n, nend, m, mdelta, gap, pol, cgap, pos);
+            default:
+                return _computeDiffRun<COPY_NEW_OVER_OLD, COMPARE_EXACT>(fb_old, fb_new, n, nend, m, mdelta, gap, pol, cgap, pos);
+                }
+            }
+
+
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
+        bool DiffBuff::_computeDiffSegment(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int y, int a, int b, int gap, const Policy& pol, int& cgap, int& pos)
+            {
+            const int n = a + DiffBuffBase::LX * y;
+            const int nend = b + 1 + DiffBuffBase::LX * y;
+            if (fb_new_orientation == PORTRAIT_320x480) return _computeDiffRun<COPY_NEW_OVER_OLD, COMPARE>(fb_old, fb_new, n, nend, n, 1, gap, pol, cgap, pos);
+            int m, mdelta;
+            switch (fb_new_orientation)
+                {
+            case LANDSCAPE_480x320:
+                m = y + DiffBuffBase::LY * (DiffBuffBase::LX - 1 - a);
+                mdelta = -DiffBuffBase::LY;
+                break;
+            case PORTRAIT_320x480_FLIPPED:
+                m = (DiffBuffBase::LX - 1 - a) + DiffBuffBase::LX * (DiffBuffBase::LY - 1 - y);
+                mdelta = -1;
+                break;
+            default: // LANDSCAPE_480x320_FLIPPED
+                m = (DiffBuffBase::LY - 1 - y) + DiffBuffBase::LY * a;
+                mdelta = DiffBuffBase::LY;
+                break;
+                }
+            return _computeDiffRun<COPY_NEW_OVER_OLD, COMPARE>(fb_old, fb_new, n, nend, m, mdelta, gap, pol, cgap, pos);
+            }
+
+
+        template<bool COPY_NEW_OVER_OLD>
+        bool DiffBuff::_computeDiffSegment(const Policy& pol, uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int y, int a, int b, int gap, int& cgap, int& pos)
+            {
+            switch (pol.compare)
+                {
+            case COMPARE_HYSTERESIS:
+                return _computeDiffSegment<COPY_NEW_OVER_OLD, COMPARE_HYSTERESIS>(fb_old, fb_new, fb_new_orientation, y, a, b, gap, pol, cgap, pos);
+            case COMPARE_TOLERANCE:
+                return _computeDiffSegment<COPY_NEW_OVER_OLD, COMPARE_TOLERANCE>(fb_old, fb_new, fb_new_orientation, y, a, b, gap, pol, cgap, pos);
+            case COMPARE_MASK:
+                return _computeDiffSegment<COPY_NEW_OVER_OLD, COMPARE_MASK>(fb_old, fb_new, fb_new_orientation, y, a, b, gap, pol, cgap, pos);
+            default:
+                return _computeDiffSegment<COPY_NEW_OVER_OLD, COMPARE_EXACT>(fb_old, fb_new, fb_new_orientation, y, a, b, gap, pol, cgap, pos);
+                }
+            }
+
+
+        template<bool COPY_NEW_OVER_OLD>
+        bool DiffBuff::_computeDiffRects(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, const Rect* boxes, int nb_boxes, int ymin, int ymax, int gap, const Policy& global, int& cgap, int& pos, int& cur)
+            {
+            // map the compare regions to orientation 0 (keeping their order, i.e. their priority). 
+            Rect regs[MAX_COMPARE_REGIONS];
+            const Policy* pols[MAX_COMPARE_REGIONS];
+            int nb_regs = 0;
+            for (int k = 0; k < MAX_COMPARE_REGIONS; k++)
+                {
+                int xmin, xmax, ymin, ymax;
+                if ((!_reg_on[k]) || (!_clipRect(fb_new_orientation, _reg_rect[k], xmin, xmax, ymin, ymax))) continue;
+                Rect& r = regs[nb_regs];
+                DiffBuffBase::rotationBox(fb_new_orientation, xmin, xmax, ymin, ymax, r.xmin, r.xmax, r.ymin, r.ymax);
+                pols[nb_regs++] = _reg_pol + k;
+                }
+
+            bool ok = true; // false when the buffer is full
+            for (int y = ymin; (ok) && (y <= ymax); y++)
+                {
+                int x = 0;
+                while (ok)
+                    {
+                    // find the leftmost span [a, b] on line y not before x, then extend it with overlapping boxes. 
+                    int a = DiffBuffBase::LX, b = -1;
+                    for (int k = 0; k < nb_boxes; k++)
+                        {
+                        const Rect& r = boxes[k];
+                        if ((y < r.ymin) || (y > r.ymax) || (r.xmax < x)) continue;
+                        const int ra = (r.xmin > x) ? r.xmin : x;
+                        if (ra < a) { a = ra; b = r.xmax; }
+                        }
+                    if (b < 0) break; // nothing more on this line
+                    bool extended = true;
+                    while (extended)
+                        {
+                        extended = false;
+                        for (int k = 0; k < nb_boxes; k++)
+                            {
+                            const Rect& r = boxes[k];
+                            if ((y >= r.ymin) && (y <= r.ymax) && (r.xmin <= b + 1) && (r.xmax > b)) { b = r.xmax; extended = true; }
+                            }
+                        }
+                    cgap += a + DiffBuffBase::LX * y - cur;
+                    // split [a, b] in segments with a constant comparison policy. 
+                    int s = a;
+                    while ((ok) && (s <= b))
+                        {
+                        const Policy* pol = &global;
+                        int e = b;
+                        int sel = nb_regs; // region containing s with the lowest index
+                        for (int k = 0; k < nb_regs; k++)
+                            {
+                            const Rect& r = regs[k];
+                            if ((y < r.ymin) || (y > r.ymax) || (r.xmax < s)) continue;
+                            if (r.xmin <= s)
+                                {
+                                if (k < sel) { sel = k; pol = pols[k]; if (r.xmax < e) e = r.xmax; }
+                                }
+                            else if ((k < sel) && (r.xmin - 1 < e)) e = r.xmin - 1; // a region with higher priority starts
+                            }
+                        ok = _computeDiffSegment<COPY_NEW_OVER_OLD>(*pol, fb_old, fb_new, fb_new_orientation, y, s, e, gap, cgap, pos);
+                        s = e + 1;
+                        }
+                    cur = b + 1 + DiffBuffBase::LX * y;
+                    x = b + 1;
+                    }
+                }
+            return ok;
+            }
+
+
+        void DiffBuff::_endDiffRects(int cgap, int pos, int cur)
+            {
+            const int cpos = DiffBuffBase::LX * DiffBuffBase::LY;
+            cgap += cpos - cur;
+            if (cpos - pos - cgap != 0)
+                {
+                _write_chunk(cpos - pos - cgap, cgap);
+                }
+            }
+
+
         void DiffBuff::statsReset()
             {
             _stat_overflow = 0;
+            _stat_coalesced = 0;
+            _stats_gap.reset();
             _stats_size.reset();
             _stats_time.reset();
+            _stats_rows_skipped.reset();
             }
 
 
@@ -785,6 +1745,14 @@ namespace ILI9488_T4
             outputStream->printf("- max. buffer size   : %u\n", _sizebuf + PADDING);
             outputStream->printf("- overflow ratio     : %.1f%%  (%u out of %u computed)\n", 100 * statsOverflowRatio(), statsNbOverflow(), statsNbComputed());
             outputStream->printf("- buffer size used   : "); _stats_size.print("", "\n", outputStream);
+            if (_stat_coalesced > 0)
+                {
+                outputStream->printf("- coalesced diffs    : %u  max. gap ", _stat_coalesced); _stats_gap.print("", "\n", outputStream);
+                }
+            if (_stats_rows_skipped.count() > 0)
+                {
+                outputStream->printf("- rows skipped       : "); _stats_rows_skipped.print("", "\n", outputStream);
+                }
             outputStream->printf("- computation time   : "); _stats_time.print("us", "\n\n", outputStream);
             }
 
@@ -826,6 +1794,596 @@ namespace ILI9488_T4
 
 
 
+        void DiffBuffTiled::computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int gap, bool copy_new_over_old, uint16_t compare_mask, uint32_t* row_sums)
+            {
+            elapsedMicros em; // for stats. 
+            if (gap < 1) gap = 1;
+            if ((fb_new_orientation < 0) || (fb_new_orientation > 3)) fb_new_orientation = 0;
+            _gap = gap;
+            memset(_dirty, 0, sizeof(_dirty));
+            if ((fb_old == nullptr) || (fb_new == nullptr)) return;
+            if (compare_mask == 0) compare_mask = 0xFFFF;
+
+            // pixel (x,y) in orientation 0 is fb_new[base + dy*y + dx*x]
+            int base, dy, dx;
+            switch (fb_new_orientation)
+                {
+                case LANDSCAPE_480x320:
+                    base = DiffBuffBase::LY * (DiffBuffBase::LX - 1); dy = 1; dx = -DiffBuffBase::LY;
+                    break;
+                case PORTRAIT_320x480_FLIPPED:
+                    base = (DiffBuffBase::LX - 1) + DiffBuffBase::LX * (DiffBuffBase::LY - 1); dy = -DiffBuffBase::LX; dx = -1;
+                    break;
+                case LANDSCAPE_480x320_FLIPPED:
+                    base = DiffBuffBase::LY - 1; dy = -1; dx = DiffBuffBase::LY;
+                    break;
+                default: // PORTRAIT_320x480
+                    base = 0; dy = DiffBuffBase::LX; dx = 1;
+                    break;
+                }
+            const bool fast = ((dx == 1) && (compare_mask == 0xFFFF)); // rows of tiles can be compared with memcmp
+
+            for (int ty = 0; ty < NB_TILES_Y; ty++)
+                {
+                for (int tx = 0; tx < NB_TILES_X; tx++)
+                    {
+                    bool dirty = false;
+                    for (int j = 0; j < TILE_SIZE; j++)
+                        {
+                        const int y = ty * TILE_SIZE + j;
+                        uint16_t* po = fb_old + (DiffBuffBase::LX * y) + (tx * TILE_SIZE);
+                        const uint16_t* pn = fb_new + base + (dy * y) + (dx * tx * TILE_SIZE);
+                        if (!dirty)
+                            {
+                            if (fast)
+                                {
+                                dirty = (memcmp(po, pn, sizeof(uint16_t) * TILE_SIZE) != 0);
+                                }
+                            else
+                                {
+                                for (int i = 0; i < TILE_SIZE; i++)
+                                    {
+                                    if ((po[i] ^ pn[dx * i]) & compare_mask) { dirty = true; break; }
+                                    }
+                                }
+                            if (!dirty) continue;
+                            if (!copy_new_over_old) break; // no need to look further
+                            }
+                        // the tile is dirty: copy the remaining rows.
+                        if (dx == 1)
+                            memcpy(po, pn, sizeof(uint16_t) * TILE_SIZE);
+                        else
+                            for (int i = 0; i < TILE_SIZE; i++) po[i] = pn[dx * i];
+                        }
+                    if (dirty) _dirty[ty] |= (((uint32_t)1) << tx);
+                    }
+                }
+            _updateRowChecksums(fb_old, fb_new, fb_new_orientation, copy_new_over_old, row_sums);
+            // done. record stats
+            _stats_tiles.push(nbDirtyTiles());
+            _stats_time.push(em);
+            }
+
+
+        bool DiffBuffTiled::computeDiffHashed(const uint16_t* fb_new, int fb_new_orientation, int gap, uint16_t compare_mask, uint32_t* tile_hashes, bool hashes_valid)
+            {
+            elapsedMicros em; // for stats. 
+            if (gap < 1) gap = 1;
+            if ((fb_new_orientation < 0) || (fb_new_orientation > 3)) fb_new_orientation = 0;
+            _gap = gap;
+            memset(_dirty, 0, sizeof(_dirty));
+            if ((fb_new == nullptr) || (tile_hashes == nullptr)) return true;
+            if (compare_mask == 0) compare_mask = 0xFFFF;
+            const uint32_t mask32 = (((uint32_t)compare_mask) << 16) | compare_mask;
+
+            // pixel (x,y) in orientation 0 is fb_new[base + dy*y + dx*x]
+            int base, dy, dx;
+            switch (fb_new_orientation)
+                {
+                case LANDSCAPE_480x320:
+                    base = DiffBuffBase::LY * (DiffBuffBase::LX - 1); dy = 1; dx = -DiffBuffBase::LY;
+                    break;
+                case PORTRAIT_320x480_FLIPPED:
+                    base = (DiffBuffBase::LX - 1) + DiffBuffBase::LX * (DiffBuffBase::LY - 1); dy = -DiffBuffBase::LX; dx = -1;
+                    break;
+                case LANDSCAPE_480x320_FLIPPED:
+                    base = DiffBuffBase::LY - 1; dy = -1; dx = DiffBuffBase::LY;
+                    break;
+                default: // PORTRAIT_320x480
+                    base = 0; dy = DiffBuffBase::LX; dx = 1;
+                    break;
+                }
+
+            // pixels are hashed in orientation 0 order so the hashes do not depend on the orientation.
+            for (int ty = 0; ty < NB_TILES_Y; ty++)
+                {
+                for (int tx = 0; tx < NB_TILES_X; tx++)
+                    {
+                    uint32_t h0 = 0x811C9DC5, h1 = 0x01000193; // 2 lanes (even/odd rows) to pipeline the multiplications
+                    for (int j = 0; j < TILE_SIZE; j += 2)
+                        {
+                        const int y = ty * TILE_SIZE + j;
+                        const uint16_t* pn = fb_new + base + (dy * y) + (dx * tx * TILE_SIZE);
+                        const uint16_t* pm = pn + dy;
+                        for (int i = 0; i < TILE_SIZE; i += 2)
+                            {
+                            const uint32_t a = (dx == 1) ? _load2px(pn + i) : (pn[dx * i] | (((uint32_t)pn[dx * (i + 1)]) << 16));
+                            const uint32_t b = (dx == 1) ? _load2px(pm + i) : (pm[dx * i] | (((uint32_t)pm[dx * (i + 1)]) << 16));
+                            h0 = _checksumStep(h0, a & mask32);
+                            h1 = _checksumStep(h1, b & mask32);
+                            }
+                        }
+                    const uint32_t h = _checksumStep(h0, h1);
+                    uint32_t & th = tile_hashes[tx + NB_TILES_X * ty];
+                    if ((!hashes_valid) || (th != h))
+                        {
+                        th = h;
+                        _dirty[ty] |= (((uint32_t)1) << tx);
+                        }
+                    }
+                }
+            // done. record stats
+            _stats_tiles.push(nbDirtyTiles());
+            _stats_time.push(em);
+            return true;
+            }
+
+
+        void DiffBuffTiled::computeDiff(uint16_t* fb_old, DiffBuffBase* diff_old, const uint16_t* sub_fb_new, int xmin, int xmax, int ymin, int ymax, int stride,
+                int fb_new_orientation, int gap, bool copy_new_over_old, uint16_t compare_mask)
+            {
+            elapsedMicros em; // for stats. 
+            if (gap < 1) gap = 1;
+            if ((fb_new_orientation < 0) || (fb_new_orientation > 3)) fb_new_orientation = 0;
+            _gap = gap;
+            memset(_dirty, 0, sizeof(_dirty));
+            if ((fb_old == nullptr) || (sub_fb_new == nullptr)) return;
+            if (compare_mask == 0) compare_mask = 0xFFFF;
+
+            if (diff_old)
+                { // mark the tiles touched by the previous diff
+                const int N = DiffBuffBase::LX * DiffBuffBase::LY;
+                diff_old->initRaw();
+                int pos = 0;
+                while (pos < N)
+                    {
+                    int nb_write, nb_skip;
+                    diff_old->readRaw(nb_write, nb_skip);
+                    if ((nb_write == 0) && (nb_skip == 0)) break; // hum...
+                    if (nb_write > N - pos) nb_write = N - pos;
+                    if (nb_write > 0) _markRun(pos, nb_write);
+                    pos += nb_write + nb_skip;
+                    }
+                }
+
+            int x1, x2, y1, y2;
+            DiffBuffBase::rotationBox(fb_new_orientation, xmin, xmax, ymin, ymax, x1, x2, y1, y2);
+            for (int yc = y1; yc <= y2; yc++)
+                {
+                int m = 0, mdelta = 0;
+                switch (fb_new_orientation)
+                    {
+                case PORTRAIT_320x480:
+                    m = stride * (yc - y1);
+                    mdelta = 1;
+                    break;
+                case LANDSCAPE_480x320:
+                    m = (yc - y1) + stride * (x2 - x1);
+                    mdelta = -stride;
+                    break;
+                case PORTRAIT_320x480_FLIPPED:
+                    m = stride * (y2 - yc) + (x2 - x1);
+                    mdelta = -1;
+                    break;
+                case LANDSCAPE_480x320_FLIPPED:
+                    m = y2 - yc;
+                    mdelta = stride;
+                    break;
+                    }
+                uint32_t& row = _dirty[yc / TILE_SIZE];
+                uint16_t* po = fb_old + (DiffBuffBase::LX * yc);
+                for (int x = x1; x <= x2; x++, m += mdelta)
+                    {
+                    if ((po[x] ^ sub_fb_new[m]) & compare_mask)
+                        {
+                        if (copy_new_over_old) po[x] = sub_fb_new[m];
+                        row |= (((uint32_t)1) << (x / TILE_SIZE));
+                        }
+                    }
+                }
+            // done. record stats
+            _stats_tiles.push(nbDirtyTiles());
+            _stats_time.push(em);
+            }
+
+
+        void DiffBuffTiled::_markRun(int pos, int len)
+            {
+            const int end = pos + len;
+            while (pos < end)
+                {
+                const int y = pos / DiffBuffBase::LX;
+                const int x = pos - DiffBuffBase::LX * y;
+                const int xe = ((end - pos) < (DiffBuffBase::LX - x)) ? (x + end - pos) : DiffBuffBase::LX; // end of the run on this line
+                const int t1 = x / TILE_SIZE;
+                const int t2 = (xe - 1) / TILE_SIZE;
+                _dirty[y / TILE_SIZE] |= ((0xFFFFFFFF >> (31 - t2)) & (0xFFFFFFFF << t1));
+                pos += xe - x;
+                }
+            }
+
+
+        void DiffBuffTiled::_nextRun(int& pos, int& nbwrite, int& nbskip) const
+            {
+            const int N = DiffBuffBase::LX * DiffBuffBase::LY;
+            if (pos >= N)
+                { // end of diff
+                nbwrite = 0;
+                nbskip = N + 1;
+                return;
+                }
+            // tiles boundaries are aligned on multiples of TILE_SIZE pixels in every line so the
+            // runs are walked one line of a tile at a time with the tile column, the line inside 
+            // the row of tiles and the row of tiles updated incrementally (no division per step). 
+            const int start = pos;
+            const int y0 = pos / DiffBuffBase::LX;
+            int ty = y0 / TILE_SIZE;
+            int ly = y0 - TILE_SIZE * ty;
+            int tx = (pos - DiffBuffBase::LX * y0) / TILE_SIZE;
+            int q = pos;
+            while (1)
+                {
+                while ((q < N) && ((_dirty[ty] >> tx) & 1)) _nextTileLine(q, tx, ly, ty);
+                const int p = q; // end of the write run
+                while ((q < N) && (!((_dirty[ty] >> tx) & 1))) _nextTileLine(q, tx, ly, ty);
+                if ((q < N) && (q - p < _gap)) continue; // gap too small, merge with the next run
+                nbwrite = p - start;
+                nbskip = q - p;
+                pos = q;
+                return;
+                }
+            }
+
+
+        int DiffBuffTiled::readDiff(int& x, int& y, int& len, int scanline)
+            {
+            if (!_r_cont)
+                { // we must load a new instruction. 
+                while (1)
+                    {
+                    if (_rpos >= DiffBuffBase::LX * DiffBuffBase::LY) return -1; // done !
+                    const int start = _rpos;
+                    int nb_write, nb_skip;
+                    _nextRun(_rpos, nb_write, nb_skip);
+                    if (nb_write > 0)
+                        {
+                        _r_y = start / DiffBuffBase::LX;
+                        _r_x = start - (DiffBuffBase::LX * _r_y);
+                        _r_len = nb_write;
+                        _r_cont = true;
+                        break;
+                        }
+                    }
+                }
+            // we have a valid instruction in _r_x, _r_y, _r_len and _r_cont=true            
+            return _splitRun(_r_x, _r_y, _r_len, _r_cont, x, y, len, scanline);
+            }
+
+
+        int DiffBuffTiled::nbDirtyTiles() const
+            {
+            int nb = 0;
+            for (int ty = 0; ty < NB_TILES_Y; ty++) nb += __builtin_popcount(_dirty[ty]);
+            return nb;
+            }
+
+
+        void DiffBuffTiled::statsReset()
+            {
+            _stats_tiles.reset();
+            _stats_time.reset();
+            }
+
+
+        void DiffBuffTiled::printStats(Stream* outputStream) const
+            {
+            outputStream->printf("---------------- DiffBuffTiled Stats -----------------\n");
+            outputStream->printf("- tile size          : %ix%i (%i tiles)\n", TILE_SIZE, TILE_SIZE, NB_TILES_X * NB_TILES_Y);
+            outputStream->printf("- diff computed      : %u\n", statsNbComputed());
+            outputStream->printf("- dirty tiles        : "); _stats_tiles.print("", "\n", outputStream);
+            outputStream->printf("- computation time   : "); _stats_time.print("us", "\n\n", outputStream);
+            }
+
+
+
+
+        /**********************************************************************************************************
+        * DiffBuffBitmap
+        ***********************************************************************************************************/
+
+
+        void DiffBuffBitmap::computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int gap, bool copy_new_over_old, uint16_t compare_mask, uint32_t* row_sums)
+            {
+            elapsedMicros em; // for stats. 
+            if (gap < 1) gap = 1;
+            if ((fb_new_orientation < 0) || (fb_new_orientation > 3)) fb_new_orientation = 0;
+            _gap = gap;
+            memset(_bits, 0, sizeof(_bits));
+            if ((fb_old == nullptr) || (fb_new == nullptr)) return;
+            if (compare_mask == 0) compare_mask = 0xFFFF;
+            int nbdirty = 0;
+
+            if (fb_new_orientation == PORTRAIT_320x480)
+                { // 32 pixels (one word of the bitmap) at a time.
+                const uint32_t mask32 = (((uint32_t)compare_mask) << 16) | compare_mask;
+                for (int w = 0; w < NB_WORDS; w++)
+                    {
+                    const int n = w << 5;
+                    uint16_t* po = fb_old + n;
+                    const uint16_t* pn = fb_new + n;
+                    uint32_t acc = 0;
+                    for (int k = 0; k < 32; k += 2) acc |= (_load2px(po + k) ^ _load2px(pn + k));
+                    if ((acc & mask32) == 0) continue; // 32 identical pixels
+                    uint32_t bits = 0;
+                    for (int k = 0; k < 32; k += 2)
+                        {
+                        const uint32_t d = (_load2px(po + k) ^ _load2px(pn + k)) & mask32;
+                        if (d & 0xFFFF) bits |= (((uint32_t)1) << k);
+                        if (d >> 16) bits |= (((uint32_t)2) << k);
+                        }
+                    _bits[w] = bits;
+                    nbdirty += __builtin_popcount(bits);
+                    if (copy_new_over_old)
+                        {
+                        for (uint32_t b = bits; b != 0; b &= (b - 1))
+                            {
+                            const int z = __builtin_ctz(b);
+                            po[z] = pn[z];
+                            }
+                        }
+                    }
+                }
+            else if (fb_new_orientation == PORTRAIT_320x480_FLIPPED)
+                { // rows of fb_new are read backward: row by row like orientation 0.
+                int n = 0;
+                for (int y = 0; y < DiffBuffBase::LY; y++)
+                    {
+                    const uint16_t* pn = fb_new + (DiffBuffBase::LX * (DiffBuffBase::LY - y)) - 1;
+                    for (int x = 0; x < DiffBuffBase::LX; x++, n++, pn--)
+                        {
+                        if ((fb_old[n] ^ (*pn)) & compare_mask)
+                            {
+                            if (copy_new_over_old) fb_old[n] = *pn;
+                            _bits[n >> 5] |= (((uint32_t)1) << (n & 31));
+                            nbdirty++;
+                            }
+                        }
+                    }
+                }
+            else
+                { // landscape framebuffer: read by tiles so that both framebuffers stay in cache. 
+                  // pixel (x,y) in orientation 0 is fb_new[base + dy*y + dx*x]
+                int base, dy, dx;
+                if (fb_new_orientation == LANDSCAPE_480x320)
+                    {
+                    base = DiffBuffBase::LY * (DiffBuffBase::LX - 1); dy = 1; dx = -DiffBuffBase::LY;
+                    }
+                else
+                    { // LANDSCAPE_480x320_FLIPPED
+                    base = DiffBuffBase::LY - 1; dy = -1; dx = DiffBuffBase::LY;
+                    }
+                for (int y0 = 0; y0 < DiffBuffBase::LY; y0 += TILE_SIZE)
+                    {
+                    for (int x = 0; x < DiffBuffBase::LX; x++)
+                        {
+                        const uint16_t* pn = fb_new + base + (dx * x) + (dy * y0);
+                        int n = x + DiffBuffBase::LX * y0;
+                        for (int t = 0; t < TILE_SIZE; t++, pn += dy, n += DiffBuffBase::LX)
+                            {
+                            if ((fb_old[n] ^ (*pn)) & compare_mask)
+                                {
+                                if (copy_new_over_old) fb_old[n] = *pn;
+                                _bits[n >> 5] |= (((uint32_t)1) << (n & 31));
+                                nbdirty++;
+                                }
+                            }
+                        }
+                    }
+                }
+            _updateRowChecksums(fb_old, fb_new, fb_new_orientation, copy_new_over_old, row_sums);
+            // done. record stats
+            _stats_pixels.push(nbdirty);
+            _stats_time.push(em);
+            }
+
+
+        void DiffBuffBitmap::computeDiff(uint16_t* fb_old, DiffBuffBase* diff_old, const uint16_t* sub_fb_new, int xmin, int xmax, int ymin, int ymax, int stride,
+                int fb_new_orientation, int gap, bool copy_new_over_old, uint16_t compare_mask)
+            {
+            elapsedMicros em; // for stats. 
+            if (gap < 1) gap = 1;
+            if ((fb_new_orientation < 0) || (fb_new_orientation > 3)) fb_new_orientation = 0;
+            _gap = gap;
+            memset(_bits, 0, sizeof(_bits));
+            if ((fb_old == nullptr) || (sub_fb_new == nullptr)) return;
+            if (compare_mask == 0) compare_mask = 0xFFFF;
+
+            if (diff_old)
+                { // mark the pixels written by the previous diff
+                const int N = DiffBuffBase::LX * DiffBuffBase::LY;
+                diff_old->initRaw();
+                int pos = 0;
+                while (pos < N)
+                    {
+                    int nb_write, nb_skip;
+                    diff_old->readRaw(nb_write, nb_skip);
+                    if ((nb_write == 0) && (nb_skip == 0)) break; // hum...
+                    if (nb_write > N - pos) nb_write = N - pos;
+                    if (nb_write > 0) _setRun(pos, nb_write);
+                    pos += nb_write + nb_skip;
+                    }
+                }
+
+            int x1, x2, y1, y2;
+            DiffBuffBase::rotationBox(fb_new_orientation, xmin, xmax, ymin, ymax, x1, x2, y1, y2);
+            for (int yc = y1; yc <= y2; yc++)
+                {
+                int m = 0, mdelta = 0;
+                switch (fb_new_orientation)
+                    {
+                case PORTRAIT_320x480:
+                    m = stride * (yc - y1);
+                    mdelta = 1;
+                    break;
+                case LANDSCAPE_480x320:
+                    m = (yc - y1) + stride * (x2 - x1);
+                    mdelta = -stride;
+                    break;
+                case PORTRAIT_320x480_FLIPPED:
+                    m = stride * (y2 - yc) + (x2 - x1);
+                    mdelta = -1;
+                    break;
+                case LANDSCAPE_480x320_FLIPPED:
+                    m = y2 - yc;
+                    mdelta = stride;
+                    break;
+                    }
+                uint16_t* po = fb_old + (DiffBuffBase::LX * yc);
+                for (int x = x1; x <= x2; x++, m += mdelta)
+                    {
+                    if ((po[x] ^ sub_fb_new[m]) & compare_mask)
+                        {
+                        if (copy_new_over_old) po[x] = sub_fb_new[m];
+                        const int n = x + DiffBuffBase::LX * yc;
+                        _bits[n >> 5] |= (((uint32_t)1) << (n & 31));
+                        }
+                    }
+                }
+            // done. record stats
+            _stats_pixels.push(nbDirtyPixels());
+            _stats_time.push(em);
+            }
+
+
+        void DiffBuffBitmap::_setRun(int pos, int len)
+            {
+            const int end = pos + len;
+            while (pos < end)
+                {
+                const int w = pos >> 5;
+                const int b = pos & 31;
+                const int l = ((end - pos) < (32 - b)) ? (end - pos) : (32 - b); // number of bits in this word
+                _bits[w] |= ((0xFFFFFFFF >> (32 - l)) << b);
+                pos += l;
+                }
+            }
+
+
+        void DiffBuffBitmap::_nextRun(int& pos, int& nbwrite, int& nbskip) const
+            {
+            const int N = DiffBuffBase::LX * DiffBuffBase::LY;
+            if (pos >= N)
+                { // end of diff
+                nbwrite = 0;
+                nbskip = N + 1;
+                return;
+                }
+            const int start = pos;
+            int p = pos;
+            while (1)
+                {
+                p = _nextClear(p); // end of the write run
+                const int q = (p < N) ? _nextSet(p) : N; // end of the skip run
+                if ((q < N) && (q - p < _gap)) 
+                    { // gap too small, merge with the next run
+                    p = q;
+                    continue;
+                    }
+                nbwrite = p - start;
+                nbskip = q - p;
+                pos = q;
+                return;
+                }
+            }
+
+
+        int DiffBuffBitmap::readDiff(int& x, int& y, int& len, int scanline)
+            {
+            if (!_r_cont)
+                { // we must load a new instruction. 
+                while (1)
+                    {
+                    if (_rpos >= DiffBuffBase::LX * DiffBuffBase::LY) return -1; // done !
+                    const int start = _rpos;
+                    int nb_write, nb_skip;
+                    _nextRun(_rpos, nb_write, nb_skip);
+                    if (nb_write > 0)
+                        {
+                        _r_y = start / DiffBuffBase::LX;
+                        _r_x = start - (DiffBuffBase::LX * _r_y);
+                        _r_len = nb_write;
+                        _r_cont = true;
+                        break;
+                        }
+                    }
+                }
+            // we have a valid instruction in _r_x, _r_y, _r_len and _r_cont=true            
+            return _splitRun(_r_x, _r_y, _r_len, _r_cont, x, y, len, scanline);
+            }
+
+
+        int DiffBuffBitmap::nbDirtyPixels(int ymin, int ymax) const
+            {
+            if (ymin < 0) ymin = 0;
+            if (ymax > DiffBuffBase::LY - 1) ymax = DiffBuffBase::LY - 1;
+            if (ymin > ymax) return 0;
+            const int start = DiffBuffBase::LX * ymin;
+            const int end = DiffBuffBase::LX * (ymax + 1);
+            int nb = 0;
+            int w = start >> 5;
+            const int we = end >> 5;
+            if (start & 31)
+                { // partial first word
+                nb += __builtin_popcount(_bits[w] & (0xFFFFFFFF << (start & 31)) & ((w == we) ? ((((uint32_t)1) << (end & 31)) - 1) : 0xFFFFFFFF));
+                if (w == we) return nb;
+                w++;
+                }
+            for (; w < we; w++) nb += __builtin_popcount(_bits[w]);
+            if ((end & 31) && (w < NB_WORDS)) nb += __builtin_popcount(_bits[w] & ((((uint32_t)1) << (end & 31)) - 1)); // partial last word
+            return nb;
+            }
+
+
+        bool DiffBuffBitmap::dirtyRows(int& ymin, int& ymax) const
+            {
+            int wmin = 0;
+            while ((wmin < NB_WORDS) && (_bits[wmin] == 0)) wmin++;
+            if (wmin == NB_WORDS) return false; // no change
+            int wmax = NB_WORDS - 1;
+            while (_bits[wmax] == 0) wmax--;
+            ymin = ((wmin << 5) + __builtin_ctz(_bits[wmin])) / DiffBuffBase::LX;
+            ymax = ((wmax << 5) + 31 - __builtin_clz(_bits[wmax])) / DiffBuffBase::LX;
+            return true;
+            }
+
+
+        void DiffBuffBitmap::statsReset()
+            {
+            _stats_pixels.reset();
+            _stats_time.reset();
+            }
+
+
+        void DiffBuffBitmap::printStats(Stream* outputStream) const
+            {
+            outputStream->printf("---------------- DiffBuffBitmap Stats ----------------\n");
+            outputStream->printf("- bitmap size        : %u bytes\n", (unsigned int)sizeof(_bits));
+            outputStream->printf("- diff computed      : %u\n", statsNbComputed());
+            outputStream->printf("- changed pixels     : "); _stats_pixels.print("", "\n", outputStream);
+            outputStream->printf("- computation time   : "); _stats_time.print("us", "\n\n", outputStream);
+            }
+
+
 
 }
 
@@ -31,10 +31,165 @@
 #include <math.h>
 
 
+/** Panel geometry (in orientation 0). Fixed at compile time: a build serves a single geometry. It can be 
+    overridden with build flags for panels of the same family with another native resolution, e.g. 
+    -DILI9488_T4_TFTWIDTH=480 -DILI9488_T4_TFTHEIGHT=320. The flags must apply to the whole build (the 
+    library sources included): defining the macros in a sketch before the #include is not enough. 
+    Sketches should size their framebuffers from these macros. See DiffBuffBase::supportedGeometry() 
+    for the constraints. */
+#ifndef ILI9488_T4_TFTWIDTH
+#define ILI9488_T4_TFTWIDTH 320                      // screen dimension x (in default orientation 0)
+#endif
+#ifndef ILI9488_T4_TFTHEIGHT
+#define ILI9488_T4_TFTHEIGHT 480                     // screen dimension y (in default orientation 0)
+#endif
+
+
 namespace ILI9488_T4
 {
 
 
+    /**
+    * A rectangular region [xmin, xmax] x [ymin, ymax] (bounds included) of a framebuffer.
+    **/
+    struct Rect
+        {
+        int xmin, xmax, ymin, ymax;
+        };
+
+
+
+    /******************************************************************************************
+    * Temporal hysteresis for diffs (used by DiffBuff when set with setHysteresis()). 
+    *
+    * A pixel that differs from the old framebuffer is only considered changed once its cell
+    * has differed during 'nb_frames' consecutive diffs, or straight away if one of its color 
+    * channel differs by more than 'threshold' (in RGB565 units). Pixels held back are not 
+    * copied to the old framebuffer (which keeps mirroring the screen) so they are compared
+    * again on the next frame. This removes the flickering of isolated pixels caused by sensor
+    * noise when streaming a camera. 
+    * 
+    * Counters are kept in a user supplied buffer with one byte per cell, a cell being a group
+    * of (1 << cell_shift) consecutive pixels on a line (in orientation 0). The buffer must have 
+    * room for bufferSize(cell_shift) bytes (e.g. 150K for cell_shift = 0, 9.6K for cell_shift = 4). 
+    * 
+    * The same object may be shared by several diffs (only one diff must be computed at a time). 
+    *******************************************************************************************/
+    class DiffHysteresis
+    {
+    public:
+
+        static const int MAX_FRAMES = 15;           // max value for nb_frames
+
+
+        /** Size (in bytes) of the counter buffer for a given cell size */
+        static constexpr int bufferSize(int cell_shift) { return ((ILI9488_T4_TFTWIDTH * ILI9488_T4_TFTHEIGHT) >> cell_shift); }
+
+
+        /**
+        * Constructor. The counter buffer must have room for bufferSize(cell_shift) bytes. 
+        **/
+        DiffHysteresis(uint8_t* counters, int cell_shift = 0, int nb_frames = 3, int threshold = 8) : _counters(counters)
+            {
+            _shift = (cell_shift < 0) ? 0 : cell_shift;
+            setParam(nb_frames, threshold);
+            reset();
+            }
+
+
+        /**
+        * Set the number of consecutive frames a cell must differ before its pixels are sent (1 = no 
+        * hysteresis) and the channel difference above which a pixel is sent straight away. 
+        **/
+        void setParam(int nb_frames, int threshold)
+            {
+            _nb_frames = (nb_frames < 1) ? 1 : ((nb_frames > MAX_FRAMES) ? MAX_FRAMES : nb_frames);
+            _threshold = (threshold < 0) ? 0 : threshold;
+            }
+
+
+        /** Reset all the counters */
+        void reset()
+            {
+            memset(_counters, 0, bufferSize(_shift));
+            _stamp = 0;
+            _held = 0;
+            _stats_held.reset();
+            }
+
+
+        /** Statistics about the number of changed pixels held back per frame. */
+        ILI9488_T4::StatsVar statsHeld() const { return _stats_held; }
+
+
+    private:
+
+        friend class DiffBuff;
+
+        uint8_t* const _counters;   // one byte per cell: (frame stamp << 4) | number of consecutive frames with differences.
+        int _shift;                 // log2 of the cell size
+        int _nb_frames;             // number of consecutive frames needed
+        int _threshold;             // channel difference for immediate upload
+        uint32_t _stamp;            // current frame stamp (1 to 15)
+        uint32_t _held;             // number of pixels held back during the current frame
+        ILI9488_T4::StatsVar _stats_held; // stats about the number of pixels held back per frame
+
+
+        /** called at the start of each diff */
+        void _startFrame()
+            {
+            _held = 0;
+            if (++_stamp > 15) _rewindStamps();
+            }
+
+
+        /**
+        * Stamps wrap around every 15 frames: clear the cells stamped during the 
+        * last cycle so that they cannot be mistaken for cells seen during the new one. 
+        * Cells stamped by the previous frame get stamp 0 so their sequence goes on. 
+        **/
+        void _rewindStamps()
+            {
+            const int n = bufferSize(_shift);
+            for (int i = 0; i < n; i++)
+                {
+                const uint8_t c = _counters[i];
+                _counters[i] = ((c >> 4) == 15) ? (c & 15) : 0;
+                }
+            _stamp = 1;
+            }
+
+
+        /** called at the end of each diff */
+        void _endFrame() { _stats_held.push(_held); }
+
+
+        /** pixel n is different in a and b: return true if it must be uploaded */
+        inline bool _mustSend(int n, uint16_t a, uint16_t b)
+            {
+            const int dr = (int)(a >> 11) - (int)(b >> 11);
+            const int dg = (int)((a >> 5) & 63) - (int)((b >> 5) & 63);
+            const int db = (int)(a & 31) - (int)(b & 31);
+            const int tg = 2 * _threshold; // green has one more bit
+            if ((dr > _threshold) || (-dr > _threshold) || (dg > tg) || (-dg > tg) || (db > _threshold) || (-db > _threshold)) return true;
+            uint8_t & c = _counters[n >> _shift];
+            const uint32_t st = c >> 4;
+            uint32_t cnt = c & 15;
+            if (st != _stamp)
+                { // first difference in this cell for this frame
+                if ((st == _stamp - 1) && (cnt < (uint32_t)_nb_frames)) cnt++; // consecutive frame
+                else cnt = 1;   // new sequence (or the cell was sent during the previous frame)
+                c = (uint8_t)((_stamp << 4) | cnt);
+                }
+            if (cnt >= (uint32_t)_nb_frames) return true;
+            _held++;
+            return false;
+            }
+
+    };
+
+
+
     /******************************************************************************************
     * Abstract base class describing the public interface of a "diff" object.
     *
@@ -53,6 +208,7 @@ namespace ILI9488_T4
     * - DiffBuff      : diff using user-supplied memory.
     * - DiffBuffStatic: diff using static memory allocation.
     * - DiffBuffDummy : diff without memory alloc holding only trivial diffs.
+    * - DiffBuffTiled : diff with tile granularity using a fixed size dirty bitmap.
     * 
     *******************************************************************************************/
     class DiffBuffBase
@@ -70,12 +226,23 @@ namespace ILI9488_T4
             };
 
 
-        static const int LX = 320;                  // framebuffer width in orientation 0
-        static const int LY = 480;                  // framebuffer height in orientation 0
+        static const int LX = ILI9488_T4_TFTWIDTH;  // framebuffer width in orientation 0
+        static const int LY = ILI9488_T4_TFTHEIGHT; // framebuffer height in orientation 0
         static const int MAX_WRITE_LINE = 160;      // max number of lines to be written in a single operation.
         static const int MIN_SCANLINE_SPACE = 8;    // min number of lines between the current write line and the current scanline
+        static const int MAX_DIRTY_RECTS = 16;      // max number of dirty rectangles handled separately (the other ones are merged together)
+        static const int MAX_COMPARE_REGIONS = 4;   // max number of regions with their own compare mask/tolerance
+
+        /**
+        * Return true if the diff classes support a panel of w x h pixels (in orientation 0): 
+        * both dimensions must be multiples of 16 (tiles and word kernels), a row of 16x16 tiles 
+        * must fit in 32 bits (w <= 512) and the number of pixels must fit the run encoding. 
+        **/
+        static constexpr bool supportedGeometry(int w, int h)
+            {
+            return ((w > 0) && (h > 0) && ((w % 16) == 0) && ((h % 16) == 0) && (w <= 32 * 16) && (w * h < (1 << 22) - 2));
+            }
 
-        static_assert((LX & 3) == 0, "LX must be divisible by 4");
 
 
         /**
@@ -109,13 +276,21 @@ namespace ILI9488_T4
         * 
         * NOTE : this method always returns a valid diff even if it runs out of memory to store the diff. However, 
         *        when this happens, the diff returned is (partly) trivial and this will have a negative impact on 
-        *        the upload speed. For optimal speed, the diff buffer size/gap parameter should be chosen such that
+        *        the upload speed (DiffBuff first tries to avoid this by progressively raising the gap when its buffer 
+        *        is filling up too fast, see statsNbCoalesced()). For optimal speed, the diff buffer size/gap parameter should be chosen such that
         *        a typical diff do not overflow... The printStats() method can be useful to find how much memory a 
         *        diff typically use and thus dimension the buffer size and gap accordingly. The size of a typical 
         *        diff will depend on how much changes occurs between frames but in most case, choosing  gap=10 and a 
         *        buffer size around 5K is a good starting point. 
+        * 
+        * row_sums       : Optional (may be nullptr) array of LY checksums, one per row of fb_old (in orientation 0)
+        *                  as returned by rowChecksum(). When provided, it must describe the current content of 
+        *                  fb_old. Rows of the new framebuffer whose checksum matches are then considered unchanged 
+        *                  without reading fb_old at all (only used when fb_new_orientation = 0). Upon return, the 
+        *                  array is updated so that it describes fb_old once it mirrors fb_new (i.e. after the copy 
+        *                  made by this method if copy_new_over_old = true or by a subsequent call to copyfb()). 
         **/
-        virtual void computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int gap, bool copy_new_over_old, uint16_t compare_mask) = 0;
+        virtual void computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int gap, bool copy_new_over_old, uint16_t compare_mask, uint32_t* row_sums = nullptr) = 0;
 
 
         /**
@@ -134,10 +309,42 @@ namespace ILI9488_T4
                                  int fb_new_orientation, int gap, bool copy_new_over_old = true, uint16_t compare_mask = 0) = 0;
 
 
+        /**
+        * Compute the diff between two framebuffers when the pixels that may have changed are known to
+        * lie inside a list of rectangles: same as the first computeDiff() method but every pixel 
+        * outside of the 'nb_dirty' rectangles of 'dirty' is assumed to be identical in fb_old and fb_new. 
+        * 
+        * The rectangles are given w.r.t. fb_new (i.e. in orientation fb_new_orientation) and are clipped
+        * to the framebuffer. If copy_new_over_old is true, only the rectangles are copied. 
+        * 
+        * The default implementation just computes the diff of the whole framebuffer. 
+        **/
+        virtual void computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, const Rect* dirty, int nb_dirty, int gap, bool copy_new_over_old, uint16_t compare_mask)
+            {
+            computeDiff(fb_old, fb_new, fb_new_orientation, gap, copy_new_over_old, compare_mask);
+            }
+
+
         /**
         * Copy the new framebuffer over the old one (and rotate it to put it in orientation 0 in fb_old). 
         **/
         static void copyfb(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation);
+
+
+        /**
+        * Copy only the rectangles 'dirty' of the new framebuffer over the old one (and rotate them to put 
+        * them in orientation 0 in fb_old). The rectangles are given w.r.t. fb_new and are clipped to the 
+        * framebuffer. 
+        **/
+        static void copyfb(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, const Rect* dirty, int nb_dirty);
+
+
+        /**
+        * Copy only the pixels of the new framebuffer that are written by 'diff' over the old one (and 
+        * rotate them to put them in orientation 0 in fb_old). Afterward, fb_old mirrors the screen 
+        * once the diff is uploaded. 
+        **/
+        static void copyfb(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, DiffBuffBase* diff);
             
 
         /**
@@ -177,6 +384,26 @@ namespace ILI9488_T4
         virtual int readDiff(int& x, int& y, int& len, int scanline) = 0;
 
 
+        /**
+        * Same as readDiff() but consecutive instructions on successive lines may be merged into 
+        * a rectangular window. The instruction is written in 'len' pixels in the columns 
+        * [x, x + w - 1] starting at (x,y) and wrapping to the next line of the window.
+        * 
+        * - For a 'linear' instruction (as returned by readDiff()), w = LX - x.
+        * - For a window, len = w * (number of lines). 
+        * 
+        * Lines are merged as long as the number of unchanged pixels added to the window stays
+        * below 'gap' pixels per line merged (i.e. the cost of the transaction saved). 
+        * 
+        * If field >= 0, only the rows y (in orientation 0) such that (y & 1) == field are returned
+        * (one line per instruction): used for interlaced uploads where the diff is sent in two passes. 
+        * 
+        * initRead() must be called before the first call (and readDiff()/readDiffWindow() should 
+        * not be mixed).
+        **/
+        int readDiffWindow(int& x, int& y, int& w, int& len, int scanline, int gap, int field = -1);
+
+
         /**
         * Call this method to reinitialize the diff prior to the first call
         * to readRaw().
@@ -191,6 +418,91 @@ namespace ILI9488_T4
         virtual void readRaw(int & nbwrite, int & nbskip) = 0;
 
 
+        /**
+        * Return the fraction of the diff memory used by the last diff computed (1 if it overflowed).
+        * Return 0 for diffs that cannot overflow.
+        **/
+        virtual float usage() const { return 0.0f; }
+
+
+        /**
+        * Set a per channel tolerance used when comparing pixels: two pixels are considered equal when 
+        * the difference between their red, green and blue components (in RGB565 units: 0-31 for red 
+        * and blue, 0-63 for green) is at most tol_red, tol_green, tol_blue respectively. 
+        * When enabled (i.e. at least one tolerance is non-zero), the tolerance replaces the compare_mask
+        * parameter of computeDiff(). Call with no argument to disable (strict comparison). 
+        * 
+        * Ignored by diffs that do not support it (only DiffBuff does). 
+        **/
+        virtual void setCompareTolerance(int tol_red = 0, int tol_green = 0, int tol_blue = 0) {}
+
+
+        /**
+        * Set (or remove with nullptr) the temporal hysteresis used when computing diffs (see DiffHysteresis). 
+        * When set, pixels held back are not written in the diff and not copied to fb_old. Since the 
+        * unchanged pixels inside a run are still uploaded, fb_old should be updated with the copyfb()
+        * method taking a diff (instead of copy_new_over_old = true) to exactly mirror the screen. 
+        * 
+        * Ignored by diffs that do not support it (only DiffBuff does). 
+        **/
+        virtual void setHysteresis(DiffHysteresis* hyst) {}
+
+
+        /**
+        * Set (or remove with region = nullptr) the compare region number 'index' (0 <= index < MAX_COMPARE_REGIONS).
+        * The region is given in the coordinates of fb_new (i.e. w.r.t. fb_new_orientation) and pixels 
+        * inside are compared with their own compare_mask or per channel tolerance (same meaning as in 
+        * computeDiff() and setCompareTolerance()) instead of the global ones. This way, a video area can 
+        * use a lossy comparison while the rest of the screen is compared exactly (or vice versa). 
+        * When regions overlap, the one with the lowest index is used. The hysteresis (if any) only 
+        * applies outside of the regions. Regions are ignored by the partial computeDiff(). 
+        * 
+        * Ignored by diffs that do not support it (only DiffBuff does). 
+        **/
+        virtual void setCompareRegion(int index, const Rect* region, uint16_t compare_mask = 0xFFFF, int tol_red = 0, int tol_green = 0, int tol_blue = 0) {}
+
+
+        /**
+        * Start computing a diff by bands of rows so that it can be read (i.e. uploaded) while it is
+        * still being computed. Same parameters as computeDiff() with copy_new_over_old = true. 
+        * computeDiffBand() must then be called until it returns -1. Meanwhile, readDiff() returns
+        * 'scanline + 1' (i.e. "wait a bit") when it reaches the part of the diff not yet computed.
+        * 
+        * Return false if not supported (only DiffBuff does, without hysteresis) in which case 
+        * computeDiff() must be used instead. 
+        **/
+        virtual bool beginDiffBands(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int gap, uint16_t compare_mask) { return false; }
+
+
+        /**
+        * Compute the diff for the next nb_rows rows (in orientation 0) and make it available for reading. 
+        * Return -1 once the diff is complete. Otherwise, return the number of pixels already available 
+        * for upload (0 if there is nothing to read yet). 
+        **/
+        virtual int computeDiffBand(int nb_rows) { return -1; }
+
+
+        /**
+        * Compute a diff without the old framebuffer ("mirror-free" diff). Instead, 'tile_hashes' holds
+        * one hash per tile of the screen content (DiffBuffTiled::NB_TILES values) and the tiles of 
+        * fb_new whose hash differs are marked as changed. The hashes are then updated to match fb_new.
+        * If hashes_valid = false, the hashes are only initialized and every tile is marked as changed. 
+        * Only the bits of compare_mask (0 = all bits) are hashed. 
+        * 
+        * The hashes are 32 bits so, in theory, a changed tile may (extremely rarely) be missed. 
+        * 
+        * Return false if not supported (only DiffBuffTiled does). 
+        **/
+        virtual bool computeDiffHashed(const uint16_t* fb_new, int fb_new_orientation, int gap, uint16_t compare_mask, uint32_t* tile_hashes, bool hashes_valid) { return false; }
+
+
+        /**
+        * Return the number of pixels written by the diff (i.e. uploaded to the screen). 
+        * Uses readRaw() (so initRaw() is called). 
+        **/
+        int nbPixels();
+
+
 
         /**
         * Transform a box according from a given orientation to orientation 0.
@@ -201,6 +513,69 @@ namespace ILI9488_T4
         static void rotationBox(int orientation, int xmin, int xmax, int ymin, int ymax, int & x1, int & x2, int & y1, int & y2);
 
 
+        /**
+        * Return the checksum of a row of LX consecutive pixels.
+        **/
+        static uint32_t rowChecksum(const uint16_t* row);
+
+
+        /**
+        * Compute the checksums of the LY rows of a framebuffer once rotated to orientation 0 
+        * (i.e. row_sums[j] is the checksum of row j of fb after copyfb(..., fb, fb_orientation)). 
+        **/
+        static void rowChecksums(const uint16_t* fb, int fb_orientation, uint32_t* row_sums);
+
+
+    protected:
+
+        int _win_state;                 // state for readDiffWindow(): 0 = nothing pending, 1 = instruction pending, 2 = diff finished.
+        int _win_x, _win_y, _win_len;   // pending instruction
+        int _fld_x, _fld_y, _fld_len;   // rest of a multi-line instruction cut by _readDiffField() (_fld_len = 0 if none). 
+
+
+        /** must be called by initRead() */
+        void _initReadWindow() { _win_state = 0; _fld_len = 0; }
+
+
+        /** Same as readDiff() but only return the lines of the given field (all lines if field < 0). */
+        int _readDiffField(int& x, int& y, int& len, int scanline, int field);
+
+
+        /**
+        * Turn the pending run (r_x, r_y, r_len) into the next instruction returned by readDiff(): 
+        * the run is cut at the end of the line when it does not start a line and according to the 
+        * scanline otherwise. r_cont is set to false once the whole run has been returned.
+        **/
+        static int _splitRun(int& r_x, int& r_y, int& r_len, bool& r_cont, int& x, int& y, int& len, int scanline);
+
+
+        /** 
+        * Clip a rectangle given in orientation 'orientation' to the framebuffer. 
+        * Return false if the clipped rectangle is empty. 
+        **/
+        static bool _clipRect(int orientation, const Rect& r, int& xmin, int& xmax, int& ymin, int& ymax)
+            {
+            const int w = (orientation & 1) ? DiffBuffBase::LY : DiffBuffBase::LX;
+            const int h = (orientation & 1) ? DiffBuffBase::LX : DiffBuffBase::LY;
+            xmin = (r.xmin < 0) ? 0 : r.xmin;
+            xmax = (r.xmax >= w) ? (w - 1) : r.xmax;
+            ymin = (r.ymin < 0) ? 0 : r.ymin;
+            ymax = (r.ymax >= h) ? (h - 1) : r.ymax;
+            return ((xmin <= xmax) && (ymin <= ymax));
+            }
+
+
+        /** update the row checksums after a diff that did not maintain them */
+        static void _updateRowChecksums(const uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, bool copy_new_over_old, uint32_t* row_sums)
+            {
+            if (row_sums == nullptr) return;
+            if (copy_new_over_old)
+                rowChecksums(fb_old, PORTRAIT_320x480, row_sums);
+            else
+                rowChecksums(fb_new, fb_new_orientation, row_sums);
+            }
+
+
     private:
         
         // copy and rotate a framebuffer
@@ -222,11 +597,20 @@ namespace ILI9488_T4
         static void _copy_rotate_180(uint16_t* fb_dest, const uint16_t* fb_src, int x1, int x2, int y1, int y2, int w, int h, int src_stride);
 
         static void _copy_rotate_270(uint16_t* fb_dest, const uint16_t* fb_src, int x1, int x2, int y1, int y2, int w, int h, int src_stride);
+
+        static const int COPY_TILE = 16; // size of the tiles used for the rotated copies
+
+        // copy a w x h block where fb_dest[i + LX*j] = fb_src[base + dx*i + DY*j] (DY = +/-1), 
+        // tile by tile with pixels transposed by 2x2 blocks in registers.
+        template<int DY> static void _copy_transpose(uint16_t* fb_dest, const uint16_t* fb_src, int w, int h, int base, int dx);
                      
 
     };
 
 
+    static_assert(DiffBuffBase::supportedGeometry(DiffBuffBase::LX, DiffBuffBase::LY), "unsupported panel geometry (ILI9488_T4_TFTWIDTH x ILI9488_T4_TFTHEIGHT)");
+
+
 
 
 
@@ -242,6 +626,11 @@ namespace ILI9488_T4
     * PERFORMANCE: On teensy 4.1, for framebuffers of size 480x320. It takes around 1ms to
     * compute a diff. This means that computing the diff consumes around 5-10% of a frame period 
     * at 60FPS (but still leaves around 15ms to generate each frame).
+    * 
+    * ENCODING: the (write, skip) runs are stored either with a 1/2/3 bytes variable length 
+    * encoding (ENCODING_VARIABLE, default, most compact) or as aligned 32 bit words holding a 
+    * 16 bit write count and a 16 bit skip count (ENCODING_WORD32, larger but faster to decode 
+    * in the DMA interrupt). See setEncoding().
     *******************************************************************************************/
     class DiffBuff : public DiffBuffBase
     {
@@ -252,25 +641,129 @@ namespace ILI9488_T4
         * Constructor. Set the buffer (and its size).
         * sizebuf should not be too small (at least MIN_BUFFER_SIZE but say 1K to be useful).
         **/
-        DiffBuff(uint8_t* buffer, size_t sizebuf) : DiffBuffBase(), _tab(buffer), _sizebuf(sizebuf - PADDING), _posw(0), _posr(0), _posraw(0)
+        DiffBuff(uint8_t* buffer, size_t sizebuf) : DiffBuffBase(), _tab(buffer), _sizebuf(sizebuf - PADDING), _posw(0), _posr(0), _posraw(0), _use_tol(false), _tol_r(0), _tol_g(0), _tol_b(0), _hyst(nullptr), _word32(false), _row_index(nullptr), _row_index_rows(1), _row_index_valid(false), _nb_regions(0)
             {
+            for (int k = 0; k < MAX_COMPARE_REGIONS; k++) _reg_on[k] = false;
+            _init_write(1);
             statsReset();
-            _write_encoded(TAG_END);
+            _end_write();
+            initRead();
+            initRaw();
+            }
+
+
+        static const int ENCODING_VARIABLE = 0;     // runs encoded with 1, 2 or 3 bytes per value (default)
+        static const int ENCODING_WORD32 = 1;       // runs encoded as 32 bit words [write:16 | skip:16] (with an escape for long runs)
+
+
+        /**
+        * Select the encoding of the diff (ENCODING_VARIABLE or ENCODING_WORD32). 
+        * 
+        * ENCODING_WORD32 uses more memory (4 bytes per run instead of 2-6) but each run is decoded
+        * with a single aligned load and no per byte branching in readDiff() which is called from 
+        * the DMA interrupt. The current diff is cleared: do not call while the diff is being read. 
+        **/
+        void setEncoding(int encoding)
+            {
+            _word32 = (encoding == ENCODING_WORD32);
+            _init_write(1);
+            _end_write();
             initRead();
             initRaw();
             }
 
 
+        /** Return the encoding used (ENCODING_VARIABLE or ENCODING_WORD32). */
+        int encoding() const { return (_word32 ? ENCODING_WORD32 : ENCODING_VARIABLE); }
+
+
+        /** Entry of the row index: position in the buffer of a [write,skip] chunk and pixel offset where it starts. */
+        struct RowIndexEntry
+            {
+            int32_t pos;
+            int32_t off;
+            };
+
+
+        /** Number of entries needed by setRowIndex() for a given number of rows per entry. */
+        static constexpr int rowIndexSize(int rows_per_entry) { return ((DiffBuffBase::LY + rows_per_entry - 1) / rows_per_entry); }
+
+
+        /**
+        * Set (or remove with index = nullptr) a side index used to start reading the diff at any row. 
+        * 
+        * The index must have room for rowIndexSize(rows_per_entry) entries (e.g. 30 entries = 240 bytes 
+        * for one entry every 16 rows). It is rebuilt each time a diff is completed (by computeDiff(), merge() 
+        * or the last computeDiffBand()) from a single pass over the runs of the diff. seekRow() can then
+        * move the reader to any band of rows in constant time so rows can be uploaded out of order or
+        * an interrupted upload can be resumed mid-frame. 
+        **/
+        void setRowIndex(RowIndexEntry* index, int rows_per_entry = 16)
+            {
+            _row_index = index;
+            _row_index_rows = (rows_per_entry < 1) ? 1 : ((rows_per_entry > DiffBuffBase::LY) ? DiffBuffBase::LY : rows_per_entry);
+            _buildRowIndex();
+            }
+
+
+        /**
+        * Move the reader (used by readDiff()) to the band of rows containing 'row' (in orientation 0). 
+        * The next instruction returned starts at the first pixel written at or after the beginning 
+        * of the band: a run (or a TAG_WRITE_ALL span) crossing the band limit is cut there. 
+        * Return false (and leave the reader unchanged) if there is no row index or if the diff is 
+        * not complete yet. 
+        **/
+        bool seekRow(int row);
+
+
+
 
-        virtual void computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int gap, bool copy_new_over_old, uint16_t compare_mask) override;
+        virtual void computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int gap, bool copy_new_over_old, uint16_t compare_mask, uint32_t* row_sums = nullptr) override;
 
 
         virtual void computeDiff(uint16_t* fb_old, DiffBuffBase* diff_old, const uint16_t* sub_fb_new, int xmin, int xmax, int ymin, int ymax, int stride,
                                  int fb_new_orientation, int gap, bool copy_new_over_old, uint16_t compare_mask) override;
 
 
+        virtual void computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, const Rect* dirty, int nb_dirty, int gap, bool copy_new_over_old, uint16_t compare_mask) override;
+
+
+        /**
+        * Set this diff as the union of the diffs a and b: a pixel is written if it is written by a 
+        * or by b. Unchanged runs shorter than gap pixels between two writes are merged (as in 
+        * computeDiff()). Runs in linear time w.r.t. the size of a and b using their readRaw() method 
+        * (so initRaw() is called on both). a and b must be distinct from this object. 
+        * 
+        * Useful to accumulate the changes of several frames (e.g. when a frame is dropped) instead
+        * of falling back to a full redraw. 
+        **/
+        void merge(DiffBuffBase* a, DiffBuffBase* b, int gap = 1);
+
+
+        virtual void setCompareTolerance(int tol_red = 0, int tol_green = 0, int tol_blue = 0) override
+            {
+            _tol_r = (tol_red < 0) ? 0 : ((tol_red > 31) ? 31 : tol_red);
+            _tol_g = (tol_green < 0) ? 0 : ((tol_green > 63) ? 63 : tol_green);
+            _tol_b = (tol_blue < 0) ? 0 : ((tol_blue > 31) ? 31 : tol_blue);
+            _use_tol = ((_tol_r | _tol_g | _tol_b) != 0);
+            }
+
+
+        virtual void setHysteresis(DiffHysteresis* hyst) override { _hyst = hyst; }
+
+
+        virtual void setCompareRegion(int index, const Rect* region, uint16_t compare_mask = 0xFFFF, int tol_red = 0, int tol_green = 0, int tol_blue = 0) override;
+
+
+        virtual bool beginDiffBands(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int gap, uint16_t compare_mask) override;
+
+
+        virtual int computeDiffBand(int nb_rows) override;
+
+
         virtual void initRead() override
             {
+            _initReadWindow();
             _r_cont = false;
             _posr = 0; 
             _off = 0; 
@@ -288,20 +781,22 @@ namespace ILI9488_T4
 
         virtual void readRaw(int& nbwrite, int& nbskip) override
             {
-            nbwrite = _read_encoded(_posraw);
-            if (nbwrite == TAG_END) 
+            uint32_t w, sk;
+            _read_chunk(_posraw, w, sk);
+            if (w == TAG_END) 
                 { 
                 nbwrite = 0;  
                 nbskip = DiffBuffBase::LX * DiffBuffBase::LY + 1;
                 }
-            else if (nbwrite == TAG_WRITE_ALL) 
+            else if (w == TAG_WRITE_ALL) 
                 { 
                 nbwrite = DiffBuffBase::LX * DiffBuffBase::LY + 1;
                 nbskip = 0; 
                 }
             else 
                 { 
-                nbskip = _read_encoded(_posraw);
+                nbwrite = (int)w;
+                nbskip = (int)sk;
                 }
             }
 
@@ -310,7 +805,10 @@ namespace ILI9488_T4
         * Return the current size of the diff.
         * (return the total size of the buffer in case of overflow).
         **/
-        int size() const { return ((_posw >= _sizebuf) ? (_sizebuf + PADDING) : _posw); }
+        int size() const { return (_overflow ? (_sizebuf + PADDING) : _posw); }
+
+
+        virtual float usage() const override { return ((float)size()) / (_sizebuf + PADDING); }
 
 
         /************************************************************************
@@ -344,6 +842,20 @@ namespace ILI9488_T4
         float statsOverflowRatio() const { return ((statsNbComputed() > 0) ? (((float)_stat_overflow) / statsNbComputed()) : 0.0f); }
 
 
+        /**
+        * Return the number of diffs for which the gap had to be raised (and runs merged) 
+        * to fit into the buffer. 
+        **/
+        uint32_t statsNbCoalesced() const { return _stat_coalesced; }
+
+
+        /**
+        * Return a StatsVar object containing statistics about the largest effective gap 
+        * used by the diffs that had to be coalesced. 
+        **/
+        ILI9488_T4::StatsVar statsCoalescedGap() const { return _stats_gap; }
+
+
         /**
         * Return a StatsVar object containing statisitcs about the time
         * it took to compute the diffs.
@@ -358,6 +870,14 @@ namespace ILI9488_T4
         ILI9488_T4::StatsVar statsSize() const { return _stats_size; }
 
 
+        /**
+        * Return a StatVar object containing statistics about the number of 
+        * rows skipped thanks to the row checksums (only for diffs computed 
+        * with a row_sums array).
+        **/
+        ILI9488_T4::StatsVar statsRowsSkipped() const { return _stats_rows_skipped; }
+
+
         /**
         * Print all the statistics into a Stream object.
         **/
@@ -369,8 +889,32 @@ namespace ILI9488_T4
 
         static const int        MIN_BUFFER_SIZE = 16;             // minimum buffer size
         static const int        PADDING = 8;                      // reserved at end of buffer (in case of overflow)
+        static constexpr float  BUDGET0 = 0.1f;                  // fraction of the buffer available at the start of the diff before coalescing runs
+        static constexpr float  BUDGET_LOW = 0.8f;               // the effective gap is lowered when below this fraction of the budget
         static const uint32_t   TAG_END = (0x400000 - 1);         // tag at end of diff
         static const uint32_t   TAG_WRITE_ALL = (0x400000 - 2);   // tag to write everything remaining
+        static const uint32_t   WORD_END = 0xFFFFFFFF;            // TAG_END with ENCODING_WORD32
+        static const uint32_t   WORD_WRITE_ALL = 0xFFFFFFFE;      // TAG_WRITE_ALL with ENCODING_WORD32
+        static const uint32_t   WORD_ESCAPE = 0xFFFF0000;         // with ENCODING_WORD32: the run is stored in the next two words (write, skip)
+        static const int        WORD_MAX_CHUNK = 12;              // max size of a run with ENCODING_WORD32
+        static const int        PUB_ALL = 0x7FFFFFFF;             // _posw_pub value when the whole diff can be read
+
+        /** comparison modes for the templated diff methods */
+        enum
+            {
+            COMPARE_EXACT = 0,      // strict equality
+            COMPARE_MASK = 1,       // equality of the bits set in compare_mask
+            COMPARE_TOLERANCE = 2,  // per channel tolerance
+            COMPARE_HYSTERESIS = 3  // mask/tolerance followed by temporal hysteresis
+            };
+
+        /** comparison policy for a part of the screen */
+        struct Policy
+            {
+            int compare;                    // comparison mode
+            uint16_t mask;                  // compare mask (0xFFFF when not used)
+            int tol_r, tol_g, tol_b;        // per channel tolerance (when compare = COMPARE_TOLERANCE or COMPARE_HYSTERESIS)
+            };
 
         uint8_t* const _tab;                // the buffer itself
         const int _sizebuf;                 // and its size (with PADDING already substracted). 
@@ -378,14 +922,51 @@ namespace ILI9488_T4
         int _posw;                          // current position in the array (for writing)
         int _posr;                          // current position in the array (for reading)
         int _posraw;                        // current position in the array for raw reading
+        volatile int _posw_pub;             // number of bytes of the diff that can be read (PUB_ALL unless computing by bands)
+        int _nbwritten;                     // number of pixels to write in the chunks written so far
 
         int _r_x, _r_y, _r_len;             // current instruction (for reading)
         bool _r_cont;                       // true is (_r_x, _r_y_, _r_len) contain a valid instruction (for reading). 
         int _off;                           // current offset
 
+        bool _overflow;                     // true if the current diff overflowed (TAG_WRITE_ALL was written).
+
+        bool _use_tol;                      // true if the per channel tolerance is enabled
+        int _tol_r, _tol_g, _tol_b;         // per channel tolerance
+        DiffHysteresis* _hyst;              // temporal hysteresis (or nullptr if not used)
+        bool _word32;                       // true for ENCODING_WORD32
+
+        RowIndexEntry* _row_index;          // index of the rows for seekRow() (or nullptr if not used)
+        int _row_index_rows;                // number of rows per entry of the index
+        bool _row_index_valid;              // true if the index describes the current diff
+
+        Rect _reg_rect[MAX_COMPARE_REGIONS];    // compare regions (in the orientation of fb_new)
+        Policy _reg_pol[MAX_COMPARE_REGIONS];   // and their comparison policies
+        bool _reg_on[MAX_COMPARE_REGIONS];      // true if the region is set
+        int _nb_regions;                        // number of regions set
+
+        bool _pend;                         // true if (_pend_write, _pend_skip) holds a chunk not yet written
+        uint32_t _pend_write, _pend_skip;   // pending chunk
+        int _npix;                          // number of pixels covered by the chunks written so far (including the pending one)
+        int _gap;                           // gap requested for the current diff
+        int _eff_gap;                       // effective gap (raised when running out of memory)
+        int _max_gap;                       // max. effective gap used during the current diff
+
+        uint16_t* _b_fb_old;                // state of the diff computed by bands: framebuffers,
+        const uint16_t* _b_fb_new;
+        int _b_orientation;                 // orientation of fb_new, 
+        Policy _b_policy;                   // comparison policy, 
+        int _b_y;                           // next row to diff, 
+        int _b_cgap, _b_pos, _b_cur;        // state of _computeDiffRects()
+        int _b_nbpub;                       // number of pixels to write already published, 
+        uint32_t _b_time;                   // and time spent so far. 
+
         volatile uint32_t _stat_overflow;   // number of times a diff buffer overflowed
+        volatile uint32_t _stat_coalesced;  // number of times the gap was raised to fit the diff
+        ILI9488_T4::StatsVar _stats_gap;    // statistics on the max effective gap for coalesced diffs
         ILI9488_T4::StatsVar _stats_size;   // statistics on buffer size
         ILI9488_T4::StatsVar _stats_time;   // statistics on compute times. 
+        ILI9488_T4::StatsVar _stats_rows_skipped; // statistics on the number of rows skipped via checksums
 
 
         /** Read a value */
@@ -439,49 +1020,333 @@ namespace ILI9488_T4
             }
 
 
-        /** Write a [write,skip] sequence in the  buffer. */
-        bool _write_chunk(uint32_t nbwrite, uint32_t nbskip)
-            {            
-            if (_posw >= _sizebuf)
-                { // running out of memory buffer
-                _write_encoded(TAG_WRITE_ALL);
-                return false;
-                }                
-            _write_encoded(nbwrite); // write remaining        
-            _write_encoded(nbskip); // skip remaining
-            return true;
+        /** Write a 32 bit word (ENCODING_WORD32) */
+        void _write_word(uint32_t val) __attribute__((always_inline))
+            {
+            memcpy(_tab + _posw, &val, 4);
+            _posw += 4;
             }
 
 
-        /** templated version of computeDiff */
-        template<bool COPY_NEW_OVER_OLD, bool USE_MASK>
-        void _computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int gap, uint16_t compare_mask);
-
-
-        /** called when the src framebuffer is in orientation 0 */
-        template<bool COPY_NEW_OVER_OLD, bool USE_MASK>
-        void _computeDiff0(uint16_t* fb_old, const uint16_t* fb_new, int gap, uint16_t compare_mask);
+        /** Read a 32 bit word (ENCODING_WORD32) */
+        uint32_t _read_word(int & pos) __attribute__((always_inline))
+            {
+            uint32_t val;
+            memcpy(&val, _tab + pos, 4);
+            pos += 4;
+            return val;
+            }
 
 
-        /** called when the src framebuffer is in orientation 1 */
-        template<bool COPY_NEW_OVER_OLD, bool USE_MASK>
-        void _computeDiff1(uint16_t* fb_old, const uint16_t* fb_new, int gap, uint16_t compare_mask);
+        /** Write TAG_END or TAG_WRITE_ALL with the current encoding */
+        void _write_tag(uint32_t tag)
+            {
+            if (_word32) 
+                _write_word((tag == TAG_END) ? WORD_END : WORD_WRITE_ALL);
+            else 
+                _write_encoded(tag);
+            }
+
+
+        /** Write a (write, skip) run with the current encoding */
+        void _write_run(uint32_t nbwrite, uint32_t nbskip) __attribute__((always_inline))
+            {
+            if (!_word32)
+                {
+                _write_encoded(nbwrite);
+                _write_encoded(nbskip);
+                }
+            else if ((nbwrite < 0xFFFF) && (nbskip <= 0xFFFF))
+                {
+                _write_word((nbwrite << 16) | nbskip);
+                }
+            else
+                { // long run
+                _write_word(WORD_ESCAPE);
+                _write_word(nbwrite);
+                _write_word(nbskip);
+                }
+            }
+
+
+        /** 
+        * Read a run with the current encoding. 
+        * Set nbwrite to TAG_END or TAG_WRITE_ALL (and nbskip to 0) for tags. 
+        **/
+        void _read_chunk(int & pos, uint32_t & nbwrite, uint32_t & nbskip) __attribute__((always_inline))
+            {
+            if (!_word32)
+                {
+                nbwrite = _read_encoded(pos);
+                nbskip = ((nbwrite == TAG_END) || (nbwrite == TAG_WRITE_ALL)) ? 0 : _read_encoded(pos);
+                return;
+                }
+            const uint32_t v = _read_word(pos);
+            if ((v >> 16) != 0xFFFF)
+                { // usual case
+                nbwrite = v >> 16;
+                nbskip = v & 0xFFFF;
+                return;
+                }
+            nbskip = 0;
+            if (v == WORD_END) nbwrite = TAG_END;
+            else if (v == WORD_WRITE_ALL) nbwrite = TAG_WRITE_ALL;
+            else
+                {
+                nbwrite = _read_word(pos);
+                nbskip = _read_word(pos);
+                }
+            }
+
+
+        /** Return true if the two colors are equal up to the per channel tolerance (tol_r, tol_g, tol_b). */
+        static inline bool _sameColor(uint16_t a, uint16_t b, int tol_r, int tol_g, int tol_b)
+            {
+            if (a == b) return true;
+            const int dr = (int)(a >> 11) - (int)(b >> 11);
+            const int dg = (int)((a >> 5) & 63) - (int)((b >> 5) & 63);
+            const int db = (int)(a & 31) - (int)(b & 31);
+            return ((((uint32_t)(dr + tol_r)) <= (uint32_t)(2 * tol_r)) & (((uint32_t)(dg + tol_g)) <= (uint32_t)(2 * tol_g)) & (((uint32_t)(db + tol_b)) <= (uint32_t)(2 * tol_b)));
+            }
+
+
+        /** Return true if the two colors are equal up to the tolerance set with setCompareTolerance(). */
+        inline bool _sameColor(uint16_t a, uint16_t b) const { return _sameColor(a, b, _tol_r, _tol_g, _tol_b); }
+
+
+        /** Return true if pixel n must be written when the hysteresis is enabled (compare_mask = 0xFFFF if not used) */
+        inline bool _hystDiffer(int n, uint16_t a, uint16_t b, uint16_t compare_mask)
+            {
+            if (((a ^ b) & compare_mask) == 0) return false;
+            if ((_use_tol) && (_sameColor(a, b))) return false;
+            return _hyst->_mustSend(n, a, b);
+            }
+
+
+        /** Return true if pixel n differs according to the comparison mode (compare_mask = 0xFFFF if not used) */
+        template<int COMPARE> inline bool _differ(int n, uint16_t a, uint16_t b, uint16_t compare_mask)
+            {
+            if (COMPARE == COMPARE_HYSTERESIS) return _hystDiffer(n, a, b, compare_mask);
+            if (COMPARE == COMPARE_TOLERANCE) return !_sameColor(a, b);
+            return (((a ^ b) & compare_mask) != 0);
+            }
+
+
+        /** Same as above with the mask and the tolerance of a comparison policy. */
+        template<int COMPARE> inline bool _differ(int n, uint16_t a, uint16_t b, const Policy& pol)
+            {
+            if (COMPARE == COMPARE_HYSTERESIS) return _hystDiffer(n, a, b, pol.mask); // only used by the global policy
+            if (COMPARE == COMPARE_TOLERANCE) return !_sameColor(a, b, pol.tol_r, pol.tol_g, pol.tol_b);
+            return (((a ^ b) & pol.mask) != 0);
+            }
+
+
+        /** Start writing a new diff. */
+        void _init_write(int gap)
+            {
+            _posw = 0;
+            _overflow = false;
+            _pend = false;
+            _npix = 0;
+            _gap = gap;
+            _eff_gap = gap;
+            _max_gap = gap;
+            _nbwritten = 0;
+            _posw_pub = PUB_ALL;
+            _row_index_valid = false;
+            }
+
+
+        /** Terminate the diff and build the row index (if any). */
+        void _end_write()
+            {
+            _write_tag(TAG_END);
+            _buildRowIndex();
+            }
+
+
+        /** Build the row index from the runs of the diff. */
+        void _buildRowIndex();
+
+
+        /** Write a [write,skip] sequence in the buffer. Return false if the buffer is full. */
+        bool _emit_chunk(uint32_t nbwrite, uint32_t nbskip)
+            {
+            if (_posw >= ((_word32) ? (_sizebuf - WORD_MAX_CHUNK + 1) : _sizebuf))
+                { // running out of memory buffer
+                _write_tag(TAG_WRITE_ALL);
+                _overflow = true;
+                _pend = false;
+                return false;
+                }                
+            _write_run(nbwrite, nbskip); // write remaining / skip remaining
+            _nbwritten += nbwrite;
+            return true;
+            }
+
+
+        /**
+        * Add a [write,skip] sequence to the diff. The sequence is kept pending so that, when 
+        * memory is getting short, it can be merged with the next one if its skip part is 
+        * smaller than the effective gap. Return false if the buffer is full.
+        **/
+        bool _write_chunk(uint32_t nbwrite, uint32_t nbskip)
+            {
+            _npix += nbwrite + nbskip;
+            if (_pend)
+                {
+                if ((int)_pend_skip < _eff_gap)
+                    { // merge the pending skip into the write
+                    _pend_write += _pend_skip + nbwrite;
+                    _pend_skip = nbskip;
+                    _adapt_gap();
+                    return true;
+                    }
+                if (!_emit_chunk(_pend_write, _pend_skip)) return false;
+                }
+            _pend = true;
+            _pend_write = nbwrite;
+            _pend_skip = nbskip;
+            _adapt_gap();
+            return true;
+            }
+
+
+        /** Write the pending chunk (if any). */
+        void _flush_chunk()
+            {
+            if (_pend)
+                {
+                _pend = false;
+                _emit_chunk(_pend_write, _pend_skip);
+                }
+            }
+
+
+        /**
+        * Update the effective gap so that the memory used stays below a budget growing linearly
+        * with the fraction of the screen already diffed (from BUDGET0 at the start to 100% at 
+        * the end): the gap is increased by 1/8 when above budget and decreased by 1/8 (down to 
+        * the requested gap) when below BUDGET_LOW * budget. Nothing to do as long as less than 
+        * half the buffer is used. 
+        **/
+        void _adapt_gap()
+            {
+            if ((2*_posw < _sizebuf) && (_eff_gap == _gap)) return; // fast path: no memory pressure
+            const float p = ((float)_npix) / (DiffBuffBase::LX * DiffBuffBase::LY);
+            const float budget = (BUDGET0 + (1.0f - BUDGET0) * p) * _sizebuf;
+            if (_posw > budget)
+                {
+                if (_eff_gap < DiffBuffBase::LX * DiffBuffBase::LY) _eff_gap += 1 + (_eff_gap >> 3);
+                if (_eff_gap > _max_gap) _max_gap = _eff_gap;
+                }
+            else if ((_eff_gap > _gap) && (_posw < BUDGET_LOW * budget))
+                {
+                _eff_gap -= 1 + (_eff_gap >> 3);
+                if (_eff_gap < _gap) _eff_gap = _gap;
+                }
+            }
+
+
+        /** templated version of computeDiff. Return true if row_sums was updated. */
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
+        bool _computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int gap, uint16_t compare_mask, uint32_t* row_sums);
+
+
+        /** diff the pixels [n, nend[ when the src framebuffer is in orientation 0 (fb_new points to the new value of pixel n). Return false on overflow */
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
+        bool _computeDiffSpan0(uint16_t* fb_old, const uint16_t* fb_new, int n, int nend, int gap, const Policy& pol, int& cgap, int& pos);
+
+
+        /** called when the src framebuffer is in orientation 0 */
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
+        void _computeDiff0(uint16_t* fb_old, const uint16_t* fb_new, int gap, uint16_t compare_mask);
+
+
+        /** called when the src framebuffer is in orientation 0 and row checksums are available. Return true if row_sums was updated */
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
+        bool _computeDiff0Rows(uint16_t* fb_old, const uint16_t* fb_new, int gap, uint16_t compare_mask, uint32_t* row_sums);
+
+
+        /** called when the src framebuffer is in orientation 1 */
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
+        void _computeDiff1(uint16_t* fb_old, const uint16_t* fb_new, int gap, uint16_t compare_mask);
 
 
         /** called when the src framebuffer is in orientation 2 */
-        template<bool COPY_NEW_OVER_OLD, bool USE_MASK>
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
         void _computeDiff2(uint16_t* fb_old, const uint16_t* fb_new, int gap, uint16_t compare_mask);
 
 
         /** called when the src framebuffer is in orientation 3 */
-        template<bool COPY_NEW_OVER_OLD, bool USE_MASK>
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
         void _computeDiff3(uint16_t* fb_old, const uint16_t* fb_new, int gap, uint16_t compare_mask);
 
 
+        static const int DIFF_TILE = 16; // size of the square tiles used for rotated framebuffers (16 pixels = one 32 bytes cache line)
+
+        /** 
+        * Diff of a rotated framebuffer where pixel (x,y) is read at fb_new[base + dx*x + dy*y] with |dy| = 1.
+        * The screen is processed by bands of DIFF_TILE lines: the band is first compared tile by tile so that 
+        * fb_new is read along its own lines, then the runs are emitted in orientation 0 order.
+        **/
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
+        void _computeDiffBlocked(uint16_t* fb_old, const uint16_t* fb_new, int base, int dx, int dy, int gap, uint16_t compare_mask);
+
+
         /** main method when computing partial diff */
         void _computeDiff(uint16_t* fb_old, DiffBuffBase* diff_old, const uint16_t* sub_fb_new, int xmin, int xmax, int ymin, int ymax, int stride,
                           int fb_new_orientation, int gap, bool copy_new_over_old, uint16_t compare_mask);
 
+
+        /** 
+        * Clip the dirty rectangles and map them to orientation 0. Store at most MAX_DIRTY_RECTS boxes 
+        * (the extra rectangles are merged in the last one). Return the number of boxes. 
+        **/
+        static int _rotateRects(int fb_new_orientation, const Rect* dirty, int nb_dirty, Rect* boxes);
+
+
+        /** Return the comparison policy used outside of the compare regions. */
+        Policy _globalPolicy(uint16_t compare_mask) const;
+
+
+        /** diff the pixels [n, nend[ read in fb_new from m with step mdelta. Return false on overflow */
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
+        bool _computeDiffPixels(uint16_t* fb_old, const uint16_t* fb_new, int n, int nend, int m, int mdelta, int gap, const Policy& pol, int& cgap, int& pos);
+
+
+        /** same as above but use the word kernel when mdelta = 1. Return false on overflow */
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
+        bool _computeDiffRun(uint16_t* fb_old, const uint16_t* fb_new, int n, int nend, int m, int mdelta, int gap, const Policy& pol, int& cgap, int& pos);
+
+
+        /** same as above with the comparison mode (exact, mask or tolerance) of pol selected at runtime. */
+        template<bool COPY_NEW_OVER_OLD>
+        bool _computeDiffRun(const Policy& pol, uint16_t* fb_old, const uint16_t* fb_new, int n, int nend, int m, int mdelta, int gap, int& cgap, int& pos);
+
+
+        /** diff the pixels [a, b] of line y (in orientation 0). Return false on overflow */
+        template<bool COPY_NEW_OVER_OLD, int COMPARE>
+        bool _computeDiffSegment(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int y, int a, int b, int gap, const Policy& pol, int& cgap, int& pos);
+
+
+        /** same as above with the comparison policy selected at runtime (once per segment). */
+        template<bool COPY_NEW_OVER_OLD>
+        bool _computeDiffSegment(const Policy& pol, uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int y, int a, int b, int gap, int& cgap, int& pos);
+
+
+        /** 
+        * Diff restricted to the boxes (already in orientation 0) for the lines [ymin, ymax]. Each line is first 
+        * split in segments according to the compare regions so that the comparison policy is selected once per 
+        * segment. (cgap, pos, cur) hold the state of the diff between calls (initially 0). Return false on overflow. 
+        **/
+        template<bool COPY_NEW_OVER_OLD>
+        bool _computeDiffRects(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, const Rect* boxes, int nb_boxes, int ymin, int ymax, int gap, const Policy& global, int& cgap, int& pos, int& cur);
+
+
+        /** complete a diff created with _computeDiffRects() */
+        void _endDiffRects(int cgap, int pos, int cur);
+
     };
 
 
@@ -542,12 +1407,13 @@ namespace ILI9488_T4
 
 
         /** dummy diff, but copy if needed*/
-        virtual void computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int gap, bool copy_new_over_old, uint16_t compare_mask) override
+        virtual void computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int gap, bool copy_new_over_old, uint16_t compare_mask, uint32_t* row_sums = nullptr) override
             {
             if (copy_new_over_old)
                 { // still copy if requested. 
                 copyfb(fb_old, fb_new, fb_new_orientation);
                 }
+            _updateRowChecksums(fb_old, fb_new, fb_new_orientation, copy_new_over_old, row_sums);
             _begin = 0;
             _end = DiffBuffBase::LY;
             initRead();
@@ -567,6 +1433,18 @@ namespace ILI9488_T4
             }
 
 
+        virtual void computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, const Rect* dirty, int nb_dirty, int gap, bool copy_new_over_old, uint16_t compare_mask) override
+            {
+            if (copy_new_over_old)
+                { // still copy if requested. 
+                copyfb(fb_old, fb_new, fb_new_orientation, dirty, nb_dirty);
+                }
+            _begin = 0;
+            _end = DiffBuffBase::LY;
+            initRead();
+            }
+
+
         /** create a diff that redraws every line in [begin, end[ */
         void computeDummyDiff(int begin = 0, int end = DiffBuffBase::LY)
             {
@@ -578,6 +1456,7 @@ namespace ILI9488_T4
 
         virtual void initRead() override
             {
+            _initReadWindow();
             _current_line = _begin;
             }
 
@@ -604,6 +1483,7 @@ namespace ILI9488_T4
                 _rawnb = 2;
                 nbwrite = DiffBuffBase::LX * (_end - _begin);
                 nbskip = DiffBuffBase::LX * (DiffBuffBase::LY - _end);
+                return;
                 }
             nbwrite = 0;
             nbskip = DiffBuffBase::LX * DiffBuffBase::LY + 1;
@@ -629,6 +1509,324 @@ namespace ILI9488_T4
 
 
 
+
+    /******************************************************************************************
+    * Class used to compute the "diff" between 2 framebuffers with tile granularity.
+    *
+    * The framebuffer (in orientation 0) is split into tiles of TILE_SIZE x TILE_SIZE pixels 
+    * and the diff only records which tiles changed in a bitmap embedded in the object. 
+    * Thus, the memory used is small and known at compile time and the diff never overflows 
+    * (there is no TAG_WRITE_ALL as with DiffBuff) but every pixel of a changed tile is 
+    * redrawn. Computing the diff can stop reading a tile as soon as a difference is found 
+    * (when copy_new_over_old = false) and reading the diff only depends on the number of 
+    * tiles.
+    * 
+    * Use DiffBuff/DiffBuffStatic for pixel-exact diffs and this class when bounded memory
+    * (and CPU time when reading the diff) matters more than upload accuracy.
+    *******************************************************************************************/
+    class DiffBuffTiled : public DiffBuffBase
+    {
+
+    public:
+
+        static const int TILE_SIZE = 16;                                    // width and height of a tile
+        static const int NB_TILES_X = DiffBuffBase::LX / TILE_SIZE;         // number of tiles per row of tiles
+        static const int NB_TILES_Y = DiffBuffBase::LY / TILE_SIZE;         // number of rows of tiles
+        static const int NB_TILES = NB_TILES_X * NB_TILES_Y;               // total number of tiles (size of the hash buffer for computeDiffHashed())
+
+        static_assert((DiffBuffBase::LX % TILE_SIZE) == 0, "LX must be a multiple of TILE_SIZE");
+        static_assert((DiffBuffBase::LY % TILE_SIZE) == 0, "LY must be a multiple of TILE_SIZE");
+        static_assert(NB_TILES_X <= 32, "a row of tiles must fit in 32 bits");
+
+
+        /** ctor. The diff is initially empty */
+        DiffBuffTiled() : DiffBuffBase(), _gap(1), _rpos(0), _rawpos(0), _r_x(0), _r_y(0), _r_len(0), _r_cont(false)
+            {
+            memset(_dirty, 0, sizeof(_dirty));
+            statsReset();
+            initRead();
+            initRaw();
+            }
+
+
+        virtual void computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int gap, bool copy_new_over_old, uint16_t compare_mask, uint32_t* row_sums = nullptr) override;
+
+
+        virtual void computeDiff(uint16_t* fb_old, DiffBuffBase* diff_old, const uint16_t* sub_fb_new, int xmin, int xmax, int ymin, int ymax, int stride,
+                                 int fb_new_orientation, int gap, bool copy_new_over_old, uint16_t compare_mask) override;
+
+
+        using DiffBuffBase::computeDiff; // dirty rectangles version: diff the whole framebuffer. 
+
+
+        virtual bool computeDiffHashed(const uint16_t* fb_new, int fb_new_orientation, int gap, uint16_t compare_mask, uint32_t* tile_hashes, bool hashes_valid) override;
+
+
+        virtual void initRead() override
+            {
+            _initReadWindow();
+            _r_cont = false;
+            _rpos = 0;
+            }
+
+
+        virtual int readDiff(int& x, int& y, int& len, int scanline) override;
+
+
+        virtual void initRaw() override
+            {
+            _rawpos = 0;
+            }
+
+
+        virtual void readRaw(int& nbwrite, int& nbskip) override
+            {
+            _nextRun(_rawpos, nbwrite, nbskip);
+            }
+
+
+        /** Return true if tile (tx, ty) is marked as changed */
+        bool isTileDirty(int tx, int ty) const { return ((_dirty[ty] >> tx) & 1); }
+
+
+        /** Return the number of tiles marked as changed in the current diff. */
+        int nbDirtyTiles() const;
+
+
+        /************************************************************************
+        * STATISTICS.
+        ************************************************************************/
+
+
+        /** Reset all statistics. */
+        void statsReset();
+
+
+        /** Return the number of diff computed (since the last call to statsReset()). */
+        uint32_t statsNbComputed() const { return _stats_tiles.count(); }
+
+
+        /** Return a StatsVar object containing statistics about the time it took to compute the diffs. */
+        ILI9488_T4::StatsVar statsTime() const { return _stats_time; }
+
+
+        /** Return a StatsVar object containing statistics about the number of dirty tiles per diff. */
+        ILI9488_T4::StatsVar statsDirtyTiles() const { return _stats_tiles; }
+
+
+        /** Print all the statistics into a Stream object. */
+        void printStats(Stream* outputStream = &Serial) const;
+
+
+    private:
+
+        uint32_t _dirty[NB_TILES_Y];        // dirty bitmap: bit tx of _dirty[ty] is set if tile (tx,ty) changed. 
+        int _gap;                           // clean runs shorter than this are merged when reading the diff
+
+        int _rpos;                          // current position (for reading)
+        int _rawpos;                        // current position (for raw reading)
+
+        int _r_x, _r_y, _r_len;             // current instruction (for reading)
+        bool _r_cont;                       // true is (_r_x, _r_y_, _r_len) contain a valid instruction (for reading). 
+
+        ILI9488_T4::StatsVar _stats_tiles;  // statistics on the number of dirty tiles
+        ILI9488_T4::StatsVar _stats_time;   // statistics on compute times. 
+
+
+        /** move the linear position q (and its tile column tx, line ly inside the row of tiles ty) to the next line of a tile */
+        static void _nextTileLine(int& q, int& tx, int& ly, int& ty) __attribute__((always_inline))
+            {
+            q += TILE_SIZE;
+            if (++tx == NB_TILES_X)
+                {
+                tx = 0;
+                if (++ly == TILE_SIZE) { ly = 0; ty++; }
+                }
+            }
+
+
+        /** mark the tiles intersecting the pixels [pos, pos + len[ as dirty */
+        void _markRun(int pos, int len);
+
+
+        /** read the next [write,skip] run starting at pos and advance pos. */
+        void _nextRun(int& pos, int& nbwrite, int& nbskip) const;
+
+    };
+
+
+
+
+
+
+    /******************************************************************************************
+    * Class used to compute the "diff" between 2 framebuffers as a bitmap.
+    *
+    * The diff stores one bit per pixel (in orientation 0), set when the pixel differs between 
+    * fb_old and fb_new. The bitmap is embedded in the object (LX*LY/8 bytes i.e. 19.2KB for 
+    * a 320x480 panel) so the memory used is known at compile time and, contrary to DiffBuff, 
+    * the diff is pixel exact and never overflows. The write/skip runs are extracted from the 
+    * bitmap with count leading/trailing zeros instructions when the diff is read. 
+    * 
+    * Since any pixel can be accessed directly, the diff can also be queried for the changes 
+    * in a given range of rows without reading it from the start. 
+    * 
+    * Tolerance, hysteresis and compare regions are not supported (only compare_mask is). 
+    *******************************************************************************************/
+    class DiffBuffBitmap : public DiffBuffBase
+    {
+
+    public:
+
+        static const int NB_WORDS = (DiffBuffBase::LX * DiffBuffBase::LY) / 32;   // size of the bitmap in 32 bit words
+
+        static_assert(((DiffBuffBase::LX * DiffBuffBase::LY) % 32) == 0, "number of pixels must be a multiple of 32");
+
+
+        /** ctor. The diff is initially empty */
+        DiffBuffBitmap() : DiffBuffBase(), _gap(1), _rpos(0), _rawpos(0), _r_x(0), _r_y(0), _r_len(0), _r_cont(false)
+            {
+            memset(_bits, 0, sizeof(_bits));
+            statsReset();
+            initRead();
+            initRaw();
+            }
+
+
+        virtual void computeDiff(uint16_t* fb_old, const uint16_t* fb_new, int fb_new_orientation, int gap, bool copy_new_over_old, uint16_t compare_mask, uint32_t* row_sums = nullptr) override;
+
+
+        virtual void computeDiff(uint16_t* fb_old, DiffBuffBase* diff_old, const uint16_t* sub_fb_new, int xmin, int xmax, int ymin, int ymax, int stride,
+                                 int fb_new_orientation, int gap, bool copy_new_over_old, uint16_t compare_mask) override;
+
+
+        using DiffBuffBase::computeDiff; // dirty rectangles version: diff the whole framebuffer. 
+
+
+        virtual void initRead() override
+            {
+            _initReadWindow();
+            _r_cont = false;
+            _rpos = 0;
+            }
+
+
+        virtual int readDiff(int& x, int& y, int& len, int scanline) override;
+
+
+        virtual void initRaw() override
+            {
+            _rawpos = 0;
+            }
+
+
+        virtual void readRaw(int& nbwrite, int& nbskip) override
+            {
+            _nextRun(_rawpos, nbwrite, nbskip);
+            }
+
+
+        /** Return true if pixel (x,y) (in orientation 0) is marked as changed */
+        bool isPixelDirty(int x, int y) const 
+            { 
+            const int n = x + DiffBuffBase::LX * y;
+            return ((_bits[n >> 5] >> (n & 31)) & 1); 
+            }
+
+
+        /** Return the number of pixels marked as changed in rows [ymin, ymax] (in orientation 0). */
+        int nbDirtyPixels(int ymin = 0, int ymax = DiffBuffBase::LY - 1) const;
+
+
+        /**
+        * Find the range of rows [ymin, ymax] (in orientation 0) that contains all the changed pixels.
+        * Return false (and leave ymin, ymax untouched) if the diff is empty. 
+        **/
+        bool dirtyRows(int& ymin, int& ymax) const;
+
+
+        /************************************************************************
+        * STATISTICS.
+        ************************************************************************/
+
+
+        /** Reset all statistics. */
+        void statsReset();
+
+
+        /** Return the number of diff computed (since the last call to statsReset()). */
+        uint32_t statsNbComputed() const { return _stats_pixels.count(); }
+
+
+        /** Return a StatsVar object containing statistics about the time it took to compute the diffs. */
+        ILI9488_T4::StatsVar statsTime() const { return _stats_time; }
+
+
+        /** Return a StatsVar object containing statistics about the number of changed pixels per diff. */
+        ILI9488_T4::StatsVar statsDirtyPixels() const { return _stats_pixels; }
+
+
+        /** Print all the statistics into a Stream object. */
+        void printStats(Stream* outputStream = &Serial) const;
+
+
+    private:
+
+        static const int TILE_SIZE = 16;    // tile size used to read rotated framebuffers
+
+        uint32_t _bits[NB_WORDS];           // bitmap: bit (n & 31) of _bits[n >> 5] is set if pixel n changed. 
+        int _gap;                           // clean runs shorter than this are merged when reading the diff
+
+        int _rpos;                          // current position (for reading)
+        int _rawpos;                        // current position (for raw reading)
+
+        int _r_x, _r_y, _r_len;             // current instruction (for reading)
+        bool _r_cont;                       // true is (_r_x, _r_y_, _r_len) contain a valid instruction (for reading). 
+
+        ILI9488_T4::StatsVar _stats_pixels; // statistics on the number of changed pixels
+        ILI9488_T4::StatsVar _stats_time;   // statistics on compute times. 
+
+
+        /** position of the first changed pixel at or after pos (LX*LY if none) */
+        int _nextSet(int pos) const
+            {
+            int w = pos >> 5;
+            uint32_t b = _bits[w] & (0xFFFFFFFF << (pos & 31));
+            while (b == 0)
+                {
+                if (++w >= NB_WORDS) return DiffBuffBase::LX * DiffBuffBase::LY;
+                b = _bits[w];
+                }
+            return (w << 5) + __builtin_ctz(b);
+            }
+
+
+        /** position of the first unchanged pixel at or after pos (LX*LY if none) */
+        int _nextClear(int pos) const
+            {
+            int w = pos >> 5;
+            uint32_t b = (~_bits[w]) & (0xFFFFFFFF << (pos & 31));
+            while (b == 0)
+                {
+                if (++w >= NB_WORDS) return DiffBuffBase::LX * DiffBuffBase::LY;
+                b = ~_bits[w];
+                }
+            return (w << 5) + __builtin_ctz(b);
+            }
+
+
+        /** mark the pixels [pos, pos + len[ as changed */
+        void _setRun(int pos, int len);
+
+
+        /** read the next [write,skip] run starting at pos and advance pos. */
+        void _nextRun(int& pos, int& nbwrite, int& nbskip) const;
+
+    };
+
+
+
+
 }
 
 #endif
@@ -42,6 +42,10 @@ namespace ILI9488_T4
         _late_start_ratio = ILI9488_T4_DEFAULT_LATE_START_RATIO;
         _late_start_ratio_override = true;
         _diff_gap = ILI9488_T4_DEFAULT_DIFF_GAP;
+        _diff_gap_auto = false;
+        _diff_band_rows = 0;
+        _transaction_cost = ILI9488_T4_TRANSACTION_DURATION;
+        _diff_gap_min = ILI9488_T4_AUTO_DIFF_GAP_MIN;
         _vsync_spacing = ILI9488_T4_DEFAULT_VSYNC_SPACING;
         _diff1 = nullptr;
         _diff2 = nullptr;
@@ -50,10 +54,34 @@ namespace ILI9488_T4
         _dummydiff1 = &_dd1;
         _dummydiff2 = &_dd2;
         _mirrorfb = nullptr;
+        _tile_hashes_valid = false;
+        _generation = 0;
+        _generation_valid = false;
         _ongoingDiff = nullptr;
 
         _fb2full = false;
         _compare_mask = 0;
+        _tol_red = 0;
+        _tol_green = 0;
+        _tol_blue = 0;
+        _hysteresis = nullptr;
+        for (int k = 0; k < DiffBuffBase::MAX_COMPARE_REGIONS; k++)
+            _cmp_region_on[k] = false;
+        _row_sums = nullptr;
+        _row_sums_valid = false;
+        _tile_hashes = nullptr;
+        _scroll_hashes = nullptr;
+        _scroll_hashes_valid = false;
+        _scroll_tfa = 0;
+        _scroll_vsa = ILI9488_T4_TFTHEIGHT;
+        _scroll_off = 0;
+        _scroll_dirty = false;
+        _scroll_pend_len = 0;
+        _nb_scrolled = 0;
+        _interlace_threshold = 0;
+        _interlace_field = 0;
+        _upload_field = -1;
+        _nb_interlaced = 0;
 
         // vsync
         _period = 0;
@@ -68,6 +96,12 @@ namespace ILI9488_T4
         _last_delta = 0;
         _timeframestart = 0;
         _last_y = 0;
+        _dma_run_src = nullptr;
+        _dma_run_remaining = 0;
+        _dma_run_w = ILI9488_T4_TFTWIDTH;
+        _dma_run_col = 0;
+        _dma_chunk_len = 0;
+        _dma_chunk_buf = 0;
 
         // spi
         _cs = cs;
@@ -110,6 +144,10 @@ namespace ILI9488_T4
         statsReset();
         resync();            // resync at first upload
         _mirrorfb = nullptr; // force full redraw.
+        _tile_hashes_valid = false;
+        _generation_valid = false;
+        _scroll_off = 0;     // the LCD is reset: send the scroll area again.
+        _scroll_dirty = true;
         _ongoingDiff = nullptr;
 
         if (_touch_cs != 255)
@@ -423,6 +461,8 @@ namespace ILI9488_T4
         waitUpdateAsyncComplete();
 
         _mirrorfb = nullptr; // force full redraw.
+        _tile_hashes_valid = false;
+        _generation_valid = false;
         _ongoingDiff = nullptr;
 
         _beginSPITransaction(_spi_clock / 4); // quarter speed
@@ -458,9 +498,19 @@ namespace ILI9488_T4
         {
             offset += (((-offset) / ILI9488_T4_TFTHEIGHT) + 1) * ILI9488_T4_TFTHEIGHT;
         }
-        offset = offset % 320;
+        offset = offset % ILI9488_T4_TFTHEIGHT;
         waitUpdateAsyncComplete();
+        _resetScroll();
+        _scroll_hashes = nullptr; // manual scrolling disables automatic scrolling.
+        _scroll_hashes_valid = false;
+        _scroll_tfa = 0;
+        _scroll_vsa = ILI9488_T4_TFTHEIGHT;
+        _scroll_dirty = false;
         _beginSPITransaction(_spi_clock);
+        _writecommand_cont(ILI9488_T4_VSCRDEF);
+        _writedata16_cont(0);
+        _writedata16_cont(ILI9488_T4_TFTHEIGHT);
+        _writedata16_cont(0);
         _writecommand_cont(ILI9488_T4_VSCRSADD);
         _writedata16_cont(offset);
         _writecommand_cont(ILI9488_T4_RAMWR); // must send RAMWR because two consecutive VSCRSADD command may stall
@@ -468,6 +518,198 @@ namespace ILI9488_T4
         _endSPITransaction();
     }
 
+    /**********************************************************************************************************
+    * Hardware scrolling
+    ***********************************************************************************************************/
+
+    void ILI9488Driver::setAutoScroll(uint32_t *row_hashes, int ymin, int ymax)
+    {
+        waitUpdateAsyncComplete();
+        _resetScroll();
+        if (ymin < 0)
+            ymin = 0;
+        if (ymax > ILI9488_T4_TFTHEIGHT - 1)
+            ymax = ILI9488_T4_TFTHEIGHT - 1;
+        if ((row_hashes == nullptr) || (ymax <= ymin))
+        { // disable
+            row_hashes = nullptr;
+            ymin = 0;
+            ymax = ILI9488_T4_TFTHEIGHT - 1;
+        }
+        _scroll_hashes = row_hashes;
+        _scroll_hashes_valid = false;
+        _scroll_tfa = ymin;
+        _scroll_vsa = ymax - ymin + 1;
+        _scroll_dirty = true; // the new scroll area is sent with the next frame.
+    }
+
+    void ILI9488Driver::_sendScroll()
+    {
+        if (!_scroll_dirty)
+            return;
+        _scroll_dirty = false;
+        _beginSPITransaction(_spi_clock);
+        _writecommand_cont(ILI9488_T4_VSCRDEF);
+        _writedata16_cont(_scroll_tfa);
+        _writedata16_cont(_scroll_vsa);
+        _writedata16_cont(ILI9488_T4_TFTHEIGHT - _scroll_tfa - _scroll_vsa);
+        _writecommand_cont(ILI9488_T4_VSCRSADD);
+        _writedata16_cont(_scroll_tfa + _scroll_off);
+        _writecommand_cont(ILI9488_T4_RAMWR); // must send RAMWR because two consecutive VSCRSADD command may stall
+        _writecommand_last(ILI9488_T4_NOP);
+        _endSPITransaction();
+    }
+
+    void ILI9488Driver::_resetScroll()
+    {
+        if (_scroll_off == 0)
+            return;
+        waitUpdateAsyncComplete();
+        _scroll_off = 0;
+        _scroll_dirty = true;
+        _sendScroll();
+        _mirrorfb = nullptr; // the screen content moved so it is not mirrored anymore.
+        _tile_hashes_valid = false;
+        _generation_valid = false;
+        _scroll_hashes_valid = false;
+        _ongoingDiff = nullptr;
+    }
+
+    void ILI9488Driver::_scrollFrame(const uint16_t *fb, bool hashes_valid, const Rect *dirty)
+    {
+        if ((_scroll_hashes == nullptr) || (dirty))
+            return; // the dirty rectangles do not allow to shift _fb1.
+        uint32_t *old_h = _scroll_hashes;                        // rows of _fb1
+        uint32_t *new_h = _scroll_hashes + ILI9488_T4_TFTHEIGHT; // rows of fb
+        DiffBuffBase::rowChecksums(fb, getRotation(), new_h);
+        const int d = (hashes_valid) ? _findScroll(old_h, new_h) : 0;
+        memcpy(old_h, new_h, ILI9488_T4_TFTHEIGHT * sizeof(uint32_t)); // _fb1 holds fb once the diff is computed.
+        _scroll_hashes_valid = true;
+        if (d == 0)
+            return;
+        // shift _fb1 as the screen will be: the diff then only contains the rows that newly appear.
+        _rotateRows(_fb1 + ILI9488_T4_TFTWIDTH * _scroll_tfa, _scroll_vsa, d);
+        _scroll_off = (_scroll_off + d) % _scroll_vsa;
+        _scroll_dirty = true;
+        _row_sums_valid = false;
+        _nb_scrolled++;
+    }
+
+    int ILI9488Driver::_findScroll(const uint32_t *old_h, const uint32_t *new_h) const
+    {
+        const int NB_PROBES = 8; // number of rows of the new frame looked up in the previous one
+        const int MAX_MATCH = 4; // probes matching more rows than this are ambiguous and ignored
+        const int a = _scroll_tfa;
+        const int b = _scroll_tfa + _scroll_vsa;
+        int best_d = 0;
+        int best_score = _scrollScore(old_h, new_h, 0) + ILI9488_T4_SCROLL_MIN_GAIN - 1;
+        for (int p = 1; p <= NB_PROBES; p++)
+        {
+            const int r = a + (p * _scroll_vsa) / (NB_PROBES + 1);
+            if ((new_h[r] == old_h[r]) || ((r > a) && (new_h[r] == new_h[r - 1])))
+                continue; // row unchanged or not distinctive (e.g. uniform background).
+            int nb = 0;
+            for (int s = a; s < b; s++)
+            {
+                if (old_h[s] == new_h[r])
+                    nb++;
+            }
+            if (nb > MAX_MATCH)
+                continue;
+            for (int s = a; (s < b) && (nb > 0); s++)
+            {
+                if (old_h[s] != new_h[r])
+                    continue;
+                nb--;
+                const int score = _scrollScore(old_h, new_h, s - r);
+                if (score > best_score)
+                {
+                    best_score = score;
+                    best_d = s - r;
+                }
+            }
+        }
+        return (best_d < 0) ? (best_d + _scroll_vsa) : best_d;
+    }
+
+    int ILI9488Driver::_scrollScore(const uint32_t *old_h, const uint32_t *new_h, int d) const
+    {
+        const int r1 = (d < 0) ? (_scroll_tfa - d) : _scroll_tfa;
+        const int r2 = (d > 0) ? (_scroll_tfa + _scroll_vsa - d) : (_scroll_tfa + _scroll_vsa);
+        int score = 0;
+        for (int r = r1; r < r2; r++)
+        {
+            if (new_h[r] == old_h[r + d])
+                score++;
+        }
+        return score;
+    }
+
+    void ILI9488Driver::_rotateRows(uint16_t *fb, int nbrows, int d)
+    {
+        uint16_t tmp[ILI9488_T4_TFTWIDTH];
+        int g = nbrows, h = d; // number of cycles = gcd(nbrows, d)
+        while (h != 0)
+        {
+            const int t = g % h;
+            g = h;
+            h = t;
+        }
+        for (int c = 0; c < g; c++)
+        { // move the rows along the cycle starting at row c
+            memcpy(tmp, fb + ILI9488_T4_TFTWIDTH * c, ILI9488_T4_TFTWIDTH * 2);
+            int r = c;
+            while (1)
+            {
+                int n = r + d;
+                if (n >= nbrows)
+                    n -= nbrows;
+                if (n == c)
+                    break;
+                memcpy(fb + ILI9488_T4_TFTWIDTH * r, fb + ILI9488_T4_TFTWIDTH * n, ILI9488_T4_TFTWIDTH * 2);
+                r = n;
+            }
+            memcpy(fb + ILI9488_T4_TFTWIDTH * r, tmp, ILI9488_T4_TFTWIDTH * 2);
+        }
+    }
+
+    int ILI9488Driver::_readDiffWindow(DiffBuffBase *diff, int &x, int &y, int &w, int &len, int scanline)
+    {
+        if (_scroll_pend_len > 0)
+        { // remainder of the previous instruction
+            x = _scroll_pend_x;
+            y = _scroll_pend_y;
+            w = _scroll_pend_w;
+            len = _scroll_pend_len;
+            _scroll_pend_len = 0;
+        }
+        else
+        {
+            const int r = diff->readDiffWindow(x, y, w, len, scanline, _diff_gap, _upload_field);
+            if ((r != 0) || (_scroll_off == 0))
+                return r;
+        }
+        // the rows of the instruction must be contiguous in the LCD memory: split it at the first seam crossed.
+        // (multi-line linear instructions always start at x = 0 so the instruction spans rows [y, y + (len - 1) / w])
+        const int y2 = y + (len - 1) / w;
+        const int seams[3] = {_scroll_tfa, _scroll_tfa + _scroll_vsa - _scroll_off, _scroll_tfa + _scroll_vsa};
+        for (int k = 0; k < 3; k++)
+        {
+            const int s = seams[k];
+            if ((y < s) && (s <= y2))
+            {
+                const int len1 = (s - y) * w;
+                _scroll_pend_x = x;
+                _scroll_pend_y = s;
+                _scroll_pend_w = w;
+                _scroll_pend_len = len - len1;
+                len = len1;
+                break;
+            }
+        }
+        return 0;
+    }
+
     /**********************************************************************************************************
     * Screen orientation
     ***********************************************************************************************************/
@@ -479,6 +721,8 @@ namespace ILI9488_T4
             return;
         waitUpdateAsyncComplete();
         _mirrorfb = nullptr; // force full redraw.
+        _tile_hashes_valid = false;
+        _generation_valid = false;
         _ongoingDiff = nullptr;
 
         statsReset();
@@ -636,7 +880,10 @@ namespace ILI9488_T4
     {
         waitUpdateAsyncComplete();
         _mirrorfb = nullptr; // complete redraw needed.
+        _tile_hashes_valid = false;
+        _generation_valid = false;
         _ongoingDiff = nullptr;
+        _row_sums_valid = false;
 
         _fb2full = false;
         if (fb1)
@@ -676,6 +923,19 @@ namespace ILI9488_T4
             _diff1 = diff2;
             _diff2 = diff1;
         }
+        if (_diff1)
+            _diff1->setCompareTolerance(_tol_red, _tol_green, _tol_blue);
+        if (_diff2)
+            _diff2->setCompareTolerance(_tol_red, _tol_green, _tol_blue);
+        if (_diff1)
+            _diff1->setHysteresis(_hysteresis);
+        if (_diff2)
+            _diff2->setHysteresis(_hysteresis);
+        for (int k = 0; k < DiffBuffBase::MAX_COMPARE_REGIONS; k++)
+        {
+            _setCompareRegion(_diff1, k);
+            _setCompareRegion(_diff2, k);
+        }
     }
 
     /**********************************************************************************************************
@@ -698,14 +958,17 @@ namespace ILI9488_T4
 
         //Write data
         _writecommand_cont(ILI9488_T4_RAMWR);
-        for (int i = 0; i < ILI9488_T4_NB_PIXELS; i++)
-            _write16BitColor(color);
+        _writeColor(color, ILI9488_T4_NB_PIXELS);
         _writecommand_last(ILI9488_T4_NOP);
         _endSPITransaction();
+        _tile_hashes_valid = false;
+        _generation_valid = false;
+        _scroll_hashes_valid = false;
         if (_fb1)
         {
             for (int i = 0; i < ILI9488_T4_NB_PIXELS; i++)
                 _fb1[i] = color;
+            _row_sums_valid = false;
             _mirrorfb = _fb1;
             _ongoingDiff = nullptr;
         }
@@ -716,13 +979,18 @@ namespace ILI9488_T4
     {
         if (stride < 0)
             stride = xmax - xmin + 1;
+        _row_sums_valid = false; // partial diffs do not maintain the row checksums.
+        _generation_valid = false;
+        _scroll_hashes_valid = false;
         switch (bufferingMode())
         {
         case NO_BUFFERING:
             // the only thing we can do is to push the sub-frame right away.
             // without DMA and without DIFF so we just upload the rectangle.
             // TODO : add vsync ?
+            _resetScroll(); // the rectangle is written directly in the LCD memory.
             _mirrorfb = nullptr;
+            _tile_hashes_valid = false;
             _ongoingDiff = nullptr;
             _updateRectNow(fb, xmin, xmax, ymin, ymax, stride);
             return;
@@ -741,13 +1009,12 @@ namespace ILI9488_T4
                 _dummydiff1->computeDiff(_fb1, nullptr, fb, xmin, xmax, ymin, ymax, stride, _rotation, _diff_gap, true, _compare_mask); // create a diff and copy to fb1.
                 if (redrawNow)
                 {
-                    if (_mirrorfb)
+                    if ((_mirrorfb) && (_scroll_off == 0))
                     {                                                       // _fb1 mirrors the screen so we just need to draw the region
                         _updateRectNow(fb, xmin, xmax, ymin, ymax, stride); // note that we can the method with fb and not _fb1. ***** TODO: replace by an async draw
                     }
                     else
                     { // redraw everything, via DMA
-                        _flush_cache(_fb1, ILI9488_T4_NB_PIXELS * 2);
                         _updateAsync(_fb1, _dummydiff1); // launch update
                     }
                     _mirrorfb = _fb1;
@@ -775,7 +1042,6 @@ namespace ILI9488_T4
                 _swapdiff();
                 if (redrawNow)
                 {
-                    _flush_cache(_fb1, ILI9488_T4_NB_PIXELS * 2);
                     _updateAsync(_fb1, _diff1);
                     _mirrorfb = _fb1;
                     _ongoingDiff = nullptr;
@@ -803,7 +1069,6 @@ namespace ILI9488_T4
                 _swapdiff();
                 if (redrawNow)
                 {
-                    _flush_cache(_fb1, ILI9488_T4_NB_PIXELS * 2);
                     _updateAsync(_fb1, _diff1);
                     _mirrorfb = _fb1;
                     _ongoingDiff = nullptr;
@@ -822,7 +1087,6 @@ namespace ILI9488_T4
             if (redrawNow)
             {                                                                                   // redraw everything
                 _dummydiff1->computeDiff(_fb1, fb, _rotation, _diff_gap, false, _compare_mask); // create a dummy diff
-                _flush_cache(_fb1, ILI9488_T4_NB_PIXELS * 2);
                 _updateAsync(_fb1, _dummydiff1);
                 _mirrorfb = _fb1; // now we mirror the screen !
             }
@@ -832,6 +1096,14 @@ namespace ILI9488_T4
 
     void ILI9488Driver::update(const uint16_t *fb, bool force_full_redraw)
     {
+        _update(fb, force_full_redraw, nullptr, 0);
+    }
+
+    void ILI9488Driver::_update(const uint16_t *fb, bool force_full_redraw, const Rect *dirty, int nb_dirty)
+    {
+        _generation_valid = false; // set again by updateIfChanged() if needed.
+        const bool scroll_hashes_valid = _scroll_hashes_valid; // set again by _scrollFrame() if needed.
+        _scroll_hashes_valid = false;
         _ongoingDiff = nullptr; // here we just ignore possible ongoing diff and just redraw everything if _mirrorfb == nullptr.
                                 // We could do better but don't care since its an edge case relevant only when swapping between
                                 // methods updateRegion() and  update() which are not usually mixed.
@@ -842,6 +1114,13 @@ namespace ILI9488_T4
         {
             waitUpdateAsyncComplete(); // wait until update is done (normally useless but still).
             _mirrorfb = nullptr;
+            if ((_tile_hashes) && (_diff1) && (_diff1->computeDiffHashed(fb, getRotation(), _diff_gap, _compare_mask, _tile_hashes, (_tile_hashes_valid) && (!force_full_redraw))))
+            { // mirror-free differential update: only the tiles whose hash changed are uploaded.
+                _tile_hashes_valid = true;
+                _updateNow(fb, _diff1);
+                return;
+            }
+            _tile_hashes_valid = false;
             _dummydiff1->computeDummyDiff();
             _updateNow(fb, _dummydiff1);
             return;
@@ -857,8 +1136,7 @@ namespace ILI9488_T4
             if ((_diff1 == nullptr) || (_mirrorfb == nullptr) || (force_full_redraw))
             {                                                                                      // do not use differential update
                 waitUpdateAsyncComplete();                                                         // wait until update is done.
-                _dummydiff1->computeDiff(_fb1, fb, getRotation(), _diff_gap, true, _compare_mask); // create a dummy diff and copy to fb1.
-                _flush_cache(_fb1, ILI9488_T4_NB_PIXELS * 2);
+                _dummydiff1->computeDiff(_fb1, fb, getRotation(), _diff_gap, true, _compare_mask, _rowSums(false)); // create a dummy diff and copy to fb1.
                 _updateAsync(_fb1, _dummydiff1); // launch update
                 _mirrorfb = _fb1;                // set as mirror
                 return;
@@ -869,15 +1147,17 @@ namespace ILI9488_T4
                 waitUpdateAsyncComplete(); // wait until update is done.
                 if ((_mirrorfb == nullptr) || (force_full_redraw))
                 {                                                                                      // complete redraw needed.
-                    _dummydiff1->computeDiff(_fb1, fb, getRotation(), _diff_gap, true, _compare_mask); // create a dummy diff and copy to fb1.
-                    _flush_cache(_fb1, ILI9488_T4_NB_PIXELS * 2);
+                    _dummydiff1->computeDiff(_fb1, fb, getRotation(), _diff_gap, true, _compare_mask, _rowSums(false)); // create a dummy diff and copy to fb1.
                     _updateAsync(_fb1, _dummydiff1); // launch update
                 }
                 else
-                {                                                                                 // diff redraw
-                    _diff1->computeDiff(_fb1, fb, getRotation(), _diff_gap, true, _compare_mask); // create a diff and copy to fb1.
-                    _flush_cache(_fb1, ILI9488_T4_NB_PIXELS * 2);
-                    _updateAsync(_fb1, _diff1); // launch update
+                {
+                    _scrollFrame(fb, scroll_hashes_valid, dirty); // hardware scroll (if enabled and detected)
+                    if (!_streamFrame(_diff1, fb, dirty))
+                    {                                       // diff redraw
+                        _diffFrame(_diff1, fb, true, dirty, nb_dirty, true); // create a diff and copy to fb1.
+                        _updateAsyncInterlaced(); // launch update
+                    }
                 }
                 _mirrorfb = _fb1; // set as mirror
                 return;
@@ -885,19 +1165,21 @@ namespace ILI9488_T4
 
             // double buffering with two diffs
             if (asyncUpdateActive())
-            {                                                                                  // _diff2 is available so we use it to create the diff while update is in progress.
-                _diff2->computeDiff(_fb1, fb, getRotation(), _diff_gap, false, _compare_mask); // create a diff without copying
-                waitUpdateAsyncComplete();                                                     // wait until update is done.
-                DiffBuff::copyfb(_fb1, fb, getRotation());                                     // save the framebuffer in fb1
-                _swapdiff();                                                                   // swap the diffs so that diff1 contain the new diff.
-                _flush_cache(_fb1, ILI9488_T4_NB_PIXELS * 2);
-                _updateAsync(_fb1, _diff1); // launch update
+            {                                     // _diff2 is available so we use it to create the diff while update is in progress.
+                _diffFrame(_diff2, fb, false, dirty, nb_dirty, true); // create a diff without copying
+                waitUpdateAsyncComplete();          // wait until update is done.
+                _copyFrame(fb, _diff2, dirty, nb_dirty);       // save the framebuffer in fb1
+                _swapdiff();                        // swap the diffs so that diff1 contain the new diff.
+                _updateAsyncInterlaced(); // launch update
             }
             else
             {
-                _diff1->computeDiff(_fb1, fb, getRotation(), _diff_gap, true, _compare_mask); // create a diff and copy
-                _flush_cache(_fb1, ILI9488_T4_NB_PIXELS * 2);
-                _updateAsync(_fb1, _diff1); // launch update
+                _scrollFrame(fb, scroll_hashes_valid, dirty); // hardware scroll (if enabled and detected)
+                if (!_streamFrame(_diff1, fb, dirty))
+                {
+                    _diffFrame(_diff1, fb, true, dirty, nb_dirty, true); // create a diff and copy
+                    _updateAsyncInterlaced(); // launch update
+                }
             }
             _mirrorfb = _fb1; // set as mirror
             return;
@@ -905,18 +1187,17 @@ namespace ILI9488_T4
 
         case TRIPLE_BUFFERING:
         {
+            _row_sums_valid = false; // row checksums are not used in triple buffering mode.
             if (!asyncUpdateActive())
             { // we can launch immediately
                 if ((_diff2 == nullptr) || (_mirrorfb == nullptr) || (force_full_redraw))
                 {                                                                                      // complete redraw needed.
                     _dummydiff1->computeDiff(_fb1, fb, getRotation(), _diff_gap, true, _compare_mask); // create a dummy diff and copy to fb1.
-                    _flush_cache(_fb1, ILI9488_T4_NB_PIXELS * 2);
                     _updateAsync(_fb1, _dummydiff1); // launch update
                 }
                 else
                 {
-                    _diff1->computeDiff(_fb1, fb, getRotation(), _diff_gap, true, _compare_mask); // create a diff and copy
-                    _flush_cache(_fb1, ILI9488_T4_NB_PIXELS * 2);
+                    _diffFrame(_diff1, fb, true, dirty, nb_dirty); // create a diff and copy
                     _updateAsync(_fb1, _diff1); // launch update
                 }
                 _mirrorfb = _fb1; // set as mirror
@@ -936,11 +1217,18 @@ namespace ILI9488_T4
             {             // update still in progress so we replace_fb2.
                 _setCB(); // remove callback to prevent upload of fb2
                 interrupts();
+                if (_fb2full)
+                    dirty = nullptr; // the pending frame in fb2 is dropped so fb1 is more than one frame behind: diff everything.
                 if ((_mirrorfb) && (!force_full_redraw) && (_diff2 != nullptr))
                 {
-                    _diff2->computeDiff(_fb1, fb, getRotation(), _diff_gap, false, _compare_mask); // create a diff without copying
-                    DiffBuff::copyfb(_fb2, fb, getRotation());                                     // save in fb2
-                    _flush_cache(_fb2, ILI9488_T4_NB_PIXELS * 2);
+                    _diffFrame(_diff2, fb, false, dirty, nb_dirty); // create a diff without copying
+                    if (_hysteresis)
+                    { // fb2 = fb1 + what is uploaded by the diff
+                        memcpy(_fb2, _fb1, ILI9488_T4_NB_PIXELS * 2);
+                        DiffBuff::copyfb(_fb2, fb, getRotation(), _diff2);
+                    }
+                    else
+                        DiffBuff::copyfb(_fb2, fb, getRotation()); // save in fb2
                     noInterrupts();
                     if (asyncUpdateActive())
                     {                                           // update still in progress...
@@ -964,7 +1252,6 @@ namespace ILI9488_T4
                 {
                     _dummydiff2->computeDiff(_fb1, fb, getRotation(), _diff_gap, false, _compare_mask); // create a dummy diff without copy
                     DiffBuff::copyfb(_fb2, fb, getRotation());                                          // save in fb2
-                    _flush_cache(_fb2, ILI9488_T4_NB_PIXELS * 2);
                     noInterrupts();
                     if (asyncUpdateActive())
                     {                                           // update still in progress...
@@ -990,13 +1277,11 @@ namespace ILI9488_T4
                 if ((_mirrorfb == nullptr) || (force_full_redraw) || (_diff2 == nullptr))
                 {                                                                                      // complete redraw needed.
                     _dummydiff1->computeDiff(_fb1, fb, getRotation(), _diff_gap, true, _compare_mask); // create a dummy diff and copy to fb1.
-                    _flush_cache(_fb1, ILI9488_T4_NB_PIXELS * 2);
                     _updateAsync(_fb1, _dummydiff1); // launch update
                 }
                 else
                 {
-                    _diff1->computeDiff(_fb1, fb, getRotation(), _diff_gap, true, _compare_mask); // create a diff and copy
-                    _flush_cache(_fb1, ILI9488_T4_NB_PIXELS * 2);
+                    _diffFrame(_diff1, fb, true, dirty, nb_dirty); // create a diff and copy
                     _updateAsync(_fb1, _diff1); // launch update
                 }
                 _mirrorfb = _fb1; // set as mirror
@@ -1006,6 +1291,86 @@ namespace ILI9488_T4
         }
     }
 
+    void ILI9488Driver::_updateAsyncInterlaced()
+    {
+        if ((_interlace_threshold <= 0) || (_diff1->nbPixels() <= _interlace_threshold))
+        { // upload the whole diff at once
+            _updateAsync(_fb1, _diff1);
+            return;
+        }
+        // upload one field now and chain the other one when it completes.
+        const int field = _interlace_field;
+        _interlace_field ^= 1; // next overloaded frame starts with the other field.
+        _nb_interlaced++;
+        _setCB(&ILI9488Driver::_interlaceFieldCB);
+        _updateAsync(_fb1, _diff1, field);
+    }
+
+    void ILI9488Driver::_interlaceFieldCB()
+    {
+        _setCB(); // disable itself.
+        _updateAsync(_fb, _diff, _upload_field ^ 1, true); // same frame and diff, other field, on the next refresh.
+    }
+
+    bool ILI9488Driver::_streamFrame(DiffBuffBase *diff, const uint16_t *fb, const Rect *dirty)
+    {
+        if ((_diff_band_rows <= 0) || (_hysteresis) || (dirty) || (_interlace_threshold > 0))
+            return false;
+        if (!diff->beginDiffBands(_fb1, fb, getRotation(), _diff_gap, _compare_mask))
+            return false;
+        _row_sums_valid = false;
+        bool launched = false;
+        while (1)
+        {
+            const int r = diff->computeDiffBand(_diff_band_rows);
+            if ((!launched) && (r != 0))
+            { // first band with changes (or diff complete): launch the upload.
+              // no cache flush needed: the pixels are converted by the CPU before being sent by DMA.
+                _updateAsync(_fb1, diff);
+                launched = true;
+            }
+            if (r < 0)
+                return true;
+        }
+    }
+
+    void ILI9488Driver::updateIfChanged(const uint16_t *fb, uint32_t generation)
+    {
+        if ((!_generation_valid) || (generation != _generation))
+        { // new content: regular update.
+            const bool drop = (bufferingMode() == DOUBLE_BUFFERING) && (_vsync_spacing == -1) && (asyncUpdateActive()); // frame will be dropped by update()
+            update(fb);
+            _generation = generation;
+            _generation_valid = !drop;
+            return;
+        }
+        // same content as the last frame: nothing to diff, copy or upload.
+        if (bufferingMode() == NO_BUFFERING)
+        {
+            _dummydiff1->computeDummyDiff(0, 0); // empty diff
+            _updateNow(fb, _dummydiff1);         // only does the frame/vsync bookkeeping
+            return;
+        }
+        if (asyncUpdateActive())
+        {
+            if ((bufferingMode() != DOUBLE_BUFFERING) || (_vsync_spacing == -1))
+                return;                // dropped by update() or, in triple buffering, the queued upload already has this content.
+            waitUpdateAsyncComplete(); // update() would wait for the upload in progress before recording the frame.
+        }
+        _dummydiff1->computeDummyDiff(0, 0); // empty diff
+        _updateAsync(_fb1, _dummydiff1);     // only does the frame/vsync bookkeeping
+    }
+
+    void ILI9488Driver::update(const uint16_t *fb, const Rect *dirty, int nb_dirty)
+    {
+        if ((dirty == nullptr) || (nb_dirty < 0))
+        { // no hint: the whole frame may have changed.
+            update(fb);
+            return;
+        }
+        _update(fb, false, dirty, nb_dirty);
+    }
+
     void ILI9488Driver::_buffer2fullCB()
     {
         if (_mirrorfb)
@@ -1030,54 +1395,62 @@ namespace ILI9488_T4
 
     void ILI9488Driver::_pushpixels_mode0(const uint16_t *fb, int x, int y, int len)
     {
-        const uint16_t *p = fb + x + (y * ILI9488_T4_TFTWIDTH);
-        while (len-- > 0)
-        {
-            _write16BitColor(*p++);
-        }
+        _writePixels(fb + x + (y * ILI9488_T4_TFTWIDTH), len, 1);
     }
 
     void ILI9488Driver::_pushpixels_mode1(const uint16_t *fb, int xx, int yy, int len)
     {
+        uint16_t buf[ILI9488_T4_PIXEL_BUF_SIZE]; // gather the pixels so that they can be packed by groups of 4
+        int k = 0;
         int x = yy;
         int y = ILI9488_T4_TFTWIDTH - 1 - xx;
         while (len-- > 0)
         {
-            _write16BitColor(fb[x + ILI9488_T4_TFTHEIGHT * y]);
+            buf[k++] = fb[x + ILI9488_T4_TFTHEIGHT * y];
             y--;
             if (y < 0)
             {
                 y = ILI9488_T4_TFTWIDTH - 1;
                 x++;
             }
+            if (k == ILI9488_T4_PIXEL_BUF_SIZE)
+            {
+                _writePixels(buf, k);
+                k = 0;
+            }
         }
+        _writePixels(buf, k);
     }
 
     void ILI9488Driver::_pushpixels_mode2(const uint16_t *fb, int xx, int yy, int len)
     {
         int x = ILI9488_T4_TFTWIDTH - 1 - xx;
         int y = ILI9488_T4_TFTHEIGHT - 1 - yy;
-        const uint16_t *p = fb + x + (y * ILI9488_T4_TFTWIDTH);
-        while (len-- > 0)
-        {
-            _write16BitColor(*p--);
-        }
+        _writePixels(fb + x + (y * ILI9488_T4_TFTWIDTH), len, -1);
     }
 
     void ILI9488Driver::_pushpixels_mode3(const uint16_t *fb, int xx, int yy, int len)
     {
+        uint16_t buf[ILI9488_T4_PIXEL_BUF_SIZE]; // gather the pixels so that they can be packed by groups of 4
+        int k = 0;
         int x = ILI9488_T4_TFTHEIGHT - 1 - yy;
         int y = xx;
         while (len-- > 0)
         {
-            _write16BitColor(fb[x + ILI9488_T4_TFTHEIGHT * y]);
+            buf[k++] = fb[x + ILI9488_T4_TFTHEIGHT * y];
             y++;
             if (y >= ILI9488_T4_TFTWIDTH)
             {
                 y = 0;
                 x--;
             }
+            if (k == ILI9488_T4_PIXEL_BUF_SIZE)
+            {
+                _writePixels(buf, k);
+                k = 0;
+            }
         }
+        _writePixels(buf, k);
     }
 
     void ILI9488Driver::_updateNow(const uint16_t *fb, DiffBuffBase *diff)
@@ -1088,9 +1461,11 @@ namespace ILI9488_T4
         _startframe(_vsync_spacing > 0);
         _margin = ILI9488_T4_NB_SCANLINES;
         _stats_nb_uploaded_pixels = 0;
+        _upload_field = -1;
         diff->initRead();
-        int x = 0, y = 0, len = 0;
-        int sc1 = diff->readDiff(x, y, len, 0); // scanline at 0 so sc1 will contain the scanline start position.
+        _scroll_pend_len = 0;
+        int x = 0, y = 0, w = 0, len = 0;
+        int sc1 = _readDiffWindow(diff, x, y, w, len, 0); // scanline at 0 so sc1 will contain the scanline start position.
         if (sc1 < 0)
         { // Diff is empty
             if (_vsync_spacing > 0)
@@ -1108,6 +1483,7 @@ namespace ILI9488_T4
                 _last_delta = (int)round(((double)(tfs - _timeframestart)) / (_period)); // number of refresh between this frame and the previous one.
                 _timeframestart = tfs;
             }
+            _sendScroll(); // nothing to upload but the scroll must still be applied.
             _endframe();
             return;
         }
@@ -1149,20 +1525,22 @@ namespace ILI9488_T4
             _last_delta = (int)round(((double)(tfs - _timeframestart)) / (_period));
             _timeframestart = tfs;
         }
+        _sendScroll(); // hardware scroll (if any) at the start of the upload, i.e. in sync with vsync.
         _beginSPITransaction(_spi_clock);
-        // write full PASET/CASET now and we shall only update the start position from now on.
+        // write full PASET/CASET now and we shall only update the start position (and window width) from now on.
         _writecommand_cont(ILI9488_T4_CASET);
         _writedata16_cont(x);
-        _writedata16_cont(ILI9488_T4_TFTWIDTH);
+        _writedata16_cont(ILI9488_T4_TFTWIDTH - 1);
         _writecommand_cont(ILI9488_T4_PASET);
-        _writedata16_cont(y);
-        _writedata16_last(ILI9488_T4_TFTHEIGHT);
+        _writedata16_cont(_memRow(y));
+        _writedata16_last(ILI9488_T4_TFTHEIGHT - 1);
         int prev_x = x;
-        int prev_y = y;
+        int prev_x2 = ILI9488_T4_TFTWIDTH - 1;
+        int prev_y = _memRow(y);
         while (1)
         {
             int asl = (_vsync_spacing > 0) ? (_slinitpos + _nbScanlineDuring(_em_async)) : (2 * ILI9488_T4_TFTHEIGHT);
-            int r = diff->readDiff(x, y, len, asl);
+            int r = _readDiffWindow(diff, x, y, w, len, asl);
             if (r > 0)
             { // we must wait
                 int t = _timeForScanlines(r - asl + 1);
@@ -1182,23 +1560,35 @@ namespace ILI9488_T4
             }
             _stats_nb_uploaded_pixels += len;
             _stats_nb_transactions++;
-            if (x != prev_x)
+            const int x2 = x + w - 1;
+            if ((x != prev_x) || (x2 != prev_x2))
             {
                 _writecommand_cont(ILI9488_T4_CASET);
                 _writedata16_cont(x);
+                _writedata16_cont(x2);
                 prev_x = x;
+                prev_x2 = x2;
             }
-            if (y != prev_y)
+            const int my = _memRow(y); // row in the LCD memory
+            if (my != prev_y)
             {
                 _writecommand_cont(ILI9488_T4_PASET);
-                _writedata16_cont(y);
-                prev_y = y;
+                _writedata16_cont(my);
+                prev_y = my;
             }
             _writecommand_cont(ILI9488_T4_RAMWR);
-            _pushpixels(fb, x, y, len);
+            if (w == ILI9488_T4_TFTWIDTH - x)
+            { // linear instruction
+                _pushpixels(fb, x, y, len);
+            }
+            else
+            { // window: push it line by line
+                for (int j = 0; j < len / w; j++)
+                    _pushpixels(fb, x, y + j, w);
+            }
             if (_vsync_spacing > 0)
             {
-                int m = (ILI9488_T4_TFTWIDTH * y + x + len) / ILI9488_T4_TFTWIDTH + ILI9488_T4_TFTHEIGHT - _slinitpos - _nbScanlineDuring(_em_async);
+                int m = _instructionEndLine(x, y, w, len) + ILI9488_T4_TFTHEIGHT - _slinitpos - _nbScanlineDuring(_em_async);
                 if (m < _margin)
                     _margin = m;
             }
@@ -1242,6 +1632,8 @@ namespace ILI9488_T4
             mdelta = stride;
             break;
         }
+        uint16_t buf[ILI9488_T4_PIXEL_BUF_SIZE]; // gather the pixels so that they can be packed by groups of 4
+        int k = 0;
         for (int yc = y1; yc <= y2; yc++)
         {
             int m = 0;
@@ -1261,15 +1653,23 @@ namespace ILI9488_T4
                 break;
             }
             for (int n = 0; n < w; n++, m += mdelta)
-                _write16BitColor(sub_fb[m]);
+            {
+                buf[k++] = sub_fb[m];
+                if (k == ILI9488_T4_PIXEL_BUF_SIZE)
+                {
+                    _writePixels(buf, k);
+                    k = 0;
+                }
+            }
         }
+        _writePixels(buf, k);
         _writecommand_last(ILI9488_T4_NOP);
         _endSPITransaction();
         _endframe();
         return;
     }
 
-    void ILI9488Driver::_updateAsync(const uint16_t *fb, DiffBuffBase *diff)
+    void ILI9488Driver::_updateAsync(const uint16_t *fb, DiffBuffBase *diff, int field, bool next_refresh)
     {
         /*
         //override and use _updateNow instead
@@ -1283,23 +1683,26 @@ namespace ILI9488_T4
             return; // do not call callback for invalid param.
         waitUpdateAsyncComplete();
         _startframe(_vsync_spacing > 0);
+        const int spacing = (next_refresh) ? 1 : _vsync_spacing; // number of refreshes since the previous upload (when > 0).
         _stats_nb_uploaded_pixels = 0;
         _margin = ILI9488_T4_NB_SCANLINES;
         _dma_state = ILI9488_T4_DMA_ON;
         _dmaObject[_spi_num] = this; // set up object callback.
-        //_flush_cache(fb, 2 * ILI9488_T4_NB_PIXELS); // BEWARE THAT CACHE IF FLUSHED BEFORE CALLING THIS METHOD !
+        // no cache flush of fb needed: the DMA only reads the line buffers filled (and flushed) by _dmaStageChunk().
         _fb = fb;
         _diff = diff;
+        _upload_field = field;
         diff->initRead();
-        int x = 0, y = 0, len = 0;
-        int sc1 = diff->readDiff(x, y, len, 0); // scanline at 0 so sc1 will contain the scanline start position.
+        _scroll_pend_len = 0;
+        int x = 0, y = 0, w = 0, len = 0;
+        int sc1 = _readDiffWindow(diff, x, y, w, len, 0); // scanline at 0 so sc1 will contain the scanline start position.
         if (sc1 < 0)
         { // Diff is empty.
             _dmaObject[_spi_num] = nullptr;
             if (_vsync_spacing > 0)
             { // note the next time.
                 uint32_t t1 = micros() + _microToReachScanLine(0, true);
-                uint32_t t2 = _timeframestart + (_vsync_spacing * _period);
+                uint32_t t2 = _timeframestart + (spacing * _period);
                 if ((t1 - t2 < _period / 3) && (t2 - t1 < _period / 3))
                 {
                     t2 = t1;
@@ -1311,6 +1714,7 @@ namespace ILI9488_T4
                 _last_delta = (int)round(((double)(tfs - _timeframestart)) / (_period)); // number of refresh between this frame and the previous one.
                 _timeframestart = tfs;
             }
+            _sendScroll(); // nothing to upload but the scroll must still be applied.
             _endframe();
             if (_touch_request_read)
             {
@@ -1331,13 +1735,14 @@ namespace ILI9488_T4
         _beginSPITransaction(_spi_clock);
         _writecommand_cont(ILI9488_T4_CASET);
         _writedata16_cont(x);
-        _writedata16_cont(ILI9488_T4_TFTWIDTH);
+        _writedata16_cont(ILI9488_T4_TFTWIDTH - 1);
         _writecommand_cont(ILI9488_T4_PASET);
-        _writedata16_cont(y);
-        _writedata16_last(ILI9488_T4_TFTHEIGHT);
+        _writedata16_cont(_memRow(y));
+        _writedata16_last(ILI9488_T4_TFTHEIGHT - 1);
         _endSPITransaction();
         _prev_caset_x = x;
-        _prev_paset_y = y;
+        _prev_caset_x2 = ILI9488_T4_TFTWIDTH - 1;
+        _prev_paset_y = _memRow(y);
         _slinitpos = sc1; // save the requested scanline initial position
 
         if (_vsync_spacing <= 0)
@@ -1348,7 +1753,7 @@ namespace ILI9488_T4
         else
         { // time the call of the next method with vsync
             _pauseUploadTime();
-            _setTimerAt(_timeframestart + (_vsync_spacing - 1) * _period, &ILI9488Driver::_subFrameTimerStartcb); // call at start of screen refresh.
+            _setTimerAt(_timeframestart + (spacing - 1) * _period, &ILI9488Driver::_subFrameTimerStartcb); // call at start of screen refresh.
         }
 
         _pauseCpuTime();
@@ -1410,11 +1815,12 @@ namespace ILI9488_T4
         }
 
         // read the first instruction
-        int x = 0, y = 0, len = 0;
+        int x = 0, y = 0, w = 0, len = 0;
         int asl = (_vsync_spacing > 0) ? _slinitpos : (2 * ILI9488_T4_TFTHEIGHT);
-        int r = _diff->readDiff(x, y, len, asl);
-        if ((r != 0) || (len == 0) || (x != _prev_caset_x) || (y != _prev_paset_y))
+        int r = _readDiffWindow(_diff, x, y, w, len, asl);
+        if ((r != 0) || (len == 0))
         { // this should not happen, but try to fail gracefully.
+            _sendScroll();
             _endframe();
             if (_touch_request_read)
             {
@@ -1432,10 +1838,17 @@ namespace ILI9488_T4
         }
 
         _dma_spi_tcr_assert = (_spi_tcr_current & ~ILI9488_T4_TCR_MASK) | (_tcr_dc_assert | LPSPI_TCR_FRAMESZ(7) | LPSPI_TCR_RXMSK);
-        _dma_spi_tcr_deassert = (_spi_tcr_current & ~ILI9488_T4_TCR_MASK) | (_tcr_dc_not_assert | LPSPI_TCR_FRAMESZ(15) | LPSPI_TCR_RXMSK); // bug with | LPSPI_TCR_CONT
+        _dma_spi_tcr_deassert = (_spi_tcr_current & ~ILI9488_T4_TCR_MASK) | (_tcr_dc_not_assert | LPSPI_TCR_FRAMESZ(23) | LPSPI_TCR_RXMSK); // 24 bits per pixel. bug with | LPSPI_TCR_CONT
+        _dma_spi_tcr_param = (_spi_tcr_current & ~ILI9488_T4_TCR_MASK) | (_tcr_dc_not_assert | LPSPI_TCR_FRAMESZ(31) | LPSPI_TCR_RXMSK);   // CASET/PASET parameters (start and end) in a single frame.
 
-        _last_y = (ILI9488_T4_TFTWIDTH * y + x + len) / ILI9488_T4_TFTWIDTH;
+        _last_y = _instructionEndLine(x, y, w, len);
         _stats_nb_uploaded_pixels = len;
+        _stats_nb_transactions++;
+
+        // convert the first chunk of the run
+        _dmaStartRun(x, y, w, len);
+        _dma_chunk_buf = 1;
+        _dmaStageChunk();
 
         /* not used...
         _dmaRAMWR = ILI9488_T4_RAMWR;
@@ -1450,9 +1863,9 @@ namespace ILI9488_T4
         _dmasettingsDiff[1].TCD->ATTR_DST = 2;
         _dmasettingsDiff[1].replaceSettingsOnCompletion(_dmasettingsDiff[2]);
 
-        _dmasettingsDiff[2].sourceBuffer(_fb + x + (y * ILI9488_T4_TFTWIDTH), 2 * len);
+        _dmasettingsDiff[2].sourceBuffer(_dma_linebuf[_dma_chunk_buf], 4 * _dma_chunk_len);
         _dmasettingsDiff[2].destination(_pimxrt_spi->TDR);
-        _dmasettingsDiff[2].TCD->ATTR_DST = 1;
+        _dmasettingsDiff[2].TCD->ATTR_DST = 2;
         _dmasettingsDiff[2].replaceSettingsOnCompletion(_dmasettingsDiff[1]);
         _dmasettingsDiff[2].interruptAtCompletion();
         _dmasettingsDiff[2].disableOnCompletion();
@@ -1467,6 +1880,8 @@ namespace ILI9488_T4
         else
             _dmatx.attachInterrupt(_dmaInterruptSPI2Diff);
 
+        _sendScroll(); // hardware scroll (if any) right before the first window write, i.e. in sync with vsync.
+
         // start spi transaction
         _beginSPITransaction(_spi_clock);
 
@@ -1476,27 +1891,34 @@ namespace ILI9488_T4
         _pimxrt_spi->SR = 0x3f00;
         _pimxrt_spi->FCR = LPSPI_FCR_TXWATER(2); // CHOOSING LPSPI_FCR_TXWATER(0) = 0 MAY BE MUCH SAFER (BUT SLOWER) ????
 
-        _pimxrt_spi->TCR = _dma_spi_tcr_assert;
-        _pimxrt_spi->TDR = ILI9488_T4_RAMWR;
+        _dmaWriteWindow(x, x + w - 1, _memRow(y));
 
         NVIC_SET_PRIORITY(IRQ_DMA_CH0 + _dmatx.channel, ILI9488_T4_IRQ_PRIORITY);
         _dmatx.begin(false);
+        _dma_chunk_len = 0;
         _dmatx.enable(); // go !
         NVIC_SET_PRIORITY(IRQ_DMA_CH0 + _dmatx.channel, ILI9488_T4_IRQ_PRIORITY);
+        _dmaStageChunk(); // convert the next chunk while the first one is being sent.
         _pauseCpuTime();
     }
 
     void ILI9488Driver::_subFrameInterruptDiff()
     {
+        if (_dma_chunk_len > 0)
+        { // the current run is not finished: send the chunk already converted and prepare the next one.
+            _dmaSendChunk();
+            _dmaStageChunk();
+            return;
+        }
         if (_vsync_spacing > 0)
         { // check margin when using vsync
             int m = _last_y + ILI9488_T4_TFTHEIGHT - _slinitpos - _nbScanlineDuring(_em_async);
             if (m < _margin)
                 _margin = m;
         }
-        int x = 0, y = 0, len = 0;
+        int x = 0, y = 0, w = 0, len = 0;
         int asl = (_vsync_spacing > 0) ? (_slinitpos + _nbScanlineDuring(_em_async)) : (2 * ILI9488_T4_TFTHEIGHT);
-        int r = _diff->readDiff(x, y, len, asl);
+        int r = _readDiffWindow(_diff, x, y, w, len, asl);
         if (r < 0)
         { // we are done !
             while (_pimxrt_spi->FSR & 0x1f)
@@ -1541,35 +1963,86 @@ namespace ILI9488_T4
             return;
         }
         // new instruction
+        _dmaWriteWindow(x, x + w - 1, _memRow(y));
+
+        _last_y = _instructionEndLine(x, y, w, len);
+        _stats_nb_uploaded_pixels += len;
+        _stats_nb_transactions++;
+
+        _dmaStartRun(x, y, w, len);
+        _dmaStageChunk();  // convert the first chunk (the spi fifo is still sending the commands)
+        _dmaSendChunk();   // start the transfer
+        _dmaStageChunk();  // and convert the second chunk in the meantime.
+        return;
+    }
+
+    void ILI9488Driver::_dmaStageChunk()
+    {
+        int n = _dma_run_remaining;
+        if (n > ILI9488_T4_DMA_LINEBUF_SIZE)
+            n = ILI9488_T4_DMA_LINEBUF_SIZE;
+        _dma_chunk_len = n;
+        if (n <= 0)
+            return; // run completed.
+        _dma_chunk_buf ^= 1; // use the buffer that is not being read by the DMA
+        uint32_t *p = _dma_linebuf[_dma_chunk_buf];
+        const uint16_t *src = _dma_run_src;
+        const int w = _dma_run_w;
+        int col = _dma_run_col;
+        int k = 0;
+        while (k < n)
+        { // follow the lines of the window
+            int c = w - col;
+            if (c > n - k)
+                c = n - k;
+            for (int i = 0; i < c; i++)
+                p[k + i] = _color565to24(src[i]);
+            k += c;
+            src += c;
+            col += c;
+            if (col == w)
+            { // next line of the window
+                col = 0;
+                src += ILI9488_T4_TFTWIDTH - w;
+            }
+        }
+        _dma_run_src = src;
+        _dma_run_col = col;
+        _dma_run_remaining -= n;
+        _flush_cache(p, 4 * n); // in case the driver object lives in DMAMEM
+    }
+
+    void ILI9488Driver::_dmaWriteWindow(int x, int x2, int y)
+    {
         _pimxrt_spi->TCR = _dma_spi_tcr_assert;
-        if (x != _prev_caset_x)
+        if ((x != _prev_caset_x) || (x2 != _prev_caset_x2))
         {
             _pimxrt_spi->TDR = ILI9488_T4_CASET;
-            _pimxrt_spi->TCR = _dma_spi_tcr_deassert;
-            _pimxrt_spi->TDR = x;
+            _pimxrt_spi->TCR = _dma_spi_tcr_param;
+            _pimxrt_spi->TDR = (((uint32_t)x) << 16) | ((uint32_t)x2); // start and end column
             _pimxrt_spi->TCR = _dma_spi_tcr_assert;
             _prev_caset_x = x;
+            _prev_caset_x2 = x2;
         }
         if (y != _prev_paset_y)
         {
             _pimxrt_spi->TDR = ILI9488_T4_PASET;
-            _pimxrt_spi->TCR = _dma_spi_tcr_deassert;
-            _pimxrt_spi->TDR = y;
+            _pimxrt_spi->TCR = _dma_spi_tcr_param;
+            _pimxrt_spi->TDR = (((uint32_t)y) << 16) | ((uint32_t)(ILI9488_T4_TFTHEIGHT - 1)); // start and end page
             _pimxrt_spi->TCR = _dma_spi_tcr_assert;
             _prev_paset_y = y;
         }
         _pimxrt_spi->TDR = ILI9488_T4_RAMWR;
+    }
 
-        _last_y = (ILI9488_T4_TFTWIDTH * y + x + len) / ILI9488_T4_TFTWIDTH;
-        _stats_nb_uploaded_pixels += len;
-
-        _dmasettingsDiff[2].sourceBuffer(_fb + x + (y * ILI9488_T4_TFTWIDTH), len * 2);
+    void ILI9488Driver::_dmaSendChunk()
+    {
+        _dmasettingsDiff[2].sourceBuffer(_dma_linebuf[_dma_chunk_buf], 4 * _dma_chunk_len);
         _dmasettingsDiff[2].destination(_pimxrt_spi->TDR);
-        _dmasettingsDiff[2].TCD->ATTR_DST = 1;
+        _dmasettingsDiff[2].TCD->ATTR_DST = 2;
         _dmasettingsDiff[2].replaceSettingsOnCompletion(_dmasettingsDiff[1]);
-
+        _dma_chunk_len = 0; // chunk consumed
         _dmatx.enable();
-        return;
     }
 
     void ILI9488Driver::_subFrameInterruptDiff2()
@@ -1582,15 +2055,34 @@ namespace ILI9488_T4
         interrupts();
     }
 
+    const uint32_t ILI9488Driver::_lut_red[32] = { // 5 bits red   -> 6 bits, placed in the first byte of the 24 bit frame
+        0x000000, 0x080000, 0x100000, 0x180000, 0x210000, 0x290000, 0x310000, 0x390000,
+        0x420000, 0x4A0000, 0x520000, 0x5A0000, 0x630000, 0x6B0000, 0x730000, 0x7B0000,
+        0x840000, 0x8C0000, 0x940000, 0x9C0000, 0xA50000, 0xAD0000, 0xB50000, 0xBD0000,
+        0xC60000, 0xCE0000, 0xD60000, 0xDE0000, 0xE70000, 0xEF0000, 0xF70000, 0xFF0000
+    };
+
+    const uint32_t ILI9488Driver::_lut_green[64] = { // 6 bits green -> 6 bits, placed in the second byte
+        0x000000, 0x000400, 0x000800, 0x000C00, 0x001000, 0x001400, 0x001800, 0x001C00,
+        0x002000, 0x002400, 0x002800, 0x002C00, 0x003000, 0x003400, 0x003800, 0x003C00,
+        0x004100, 0x004500, 0x004900, 0x004D00, 0x005100, 0x005500, 0x005900, 0x005D00,
+        0x006100, 0x006500, 0x006900, 0x006D00, 0x007100, 0x007500, 0x007900, 0x007D00,
+        0x008200, 0x008600, 0x008A00, 0x008E00, 0x009200, 0x009600, 0x009A00, 0x009E00,
+        0x00A200, 0x00A600, 0x00AA00, 0x00AE00, 0x00B200, 0x00B600, 0x00BA00, 0x00BE00,
+        0x00C300, 0x00C700, 0x00CB00, 0x00CF00, 0x00D300, 0x00D700, 0x00DB00, 0x00DF00,
+        0x00E300, 0x00E700, 0x00EB00, 0x00EF00, 0x00F300, 0x00F700, 0x00FB00, 0x00FF00
+    };
+
+    const uint32_t ILI9488Driver::_lut_blue[32] = { // 5 bits blue  -> 6 bits, placed in the third byte
+        0x000000, 0x000008, 0x000010, 0x000018, 0x000021, 0x000029, 0x000031, 0x000039,
+        0x000042, 0x00004A, 0x000052, 0x00005A, 0x000063, 0x00006B, 0x000073, 0x00007B,
+        0x000084, 0x00008C, 0x000094, 0x00009C, 0x0000A5, 0x0000AD, 0x0000B5, 0x0000BD,
+        0x0000C6, 0x0000CE, 0x0000D6, 0x0000DE, 0x0000E7, 0x0000EF, 0x0000F7, 0x0000FF
+    };
+
     void ILI9488Driver::_write16BitColor(uint16_t color, bool last_pixel)
     {
-        uint8_t r = (color & 0xF800) >> 11;
-        uint8_t g = (color & 0x07E0) >> 5;
-        uint8_t b = color & 0x001F;
-        r = (r * 255) / 31;
-        g = (g * 255) / 63;
-        b = (b * 255) / 31;
-        uint32_t color24 = ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+        const uint32_t color24 = _color565to24(color);
 
         if (last_pixel)
         {
@@ -1610,13 +2102,7 @@ namespace ILI9488_T4
 
     void ILI9488Driver::_write16BitColor(uint16_t color, uint16_t count, bool last_pixel)
     {
-        uint8_t r = (color & 0xF800) >> 11;
-        uint8_t g = (color & 0x07E0) >> 5;
-        uint8_t b = color & 0x001F;
-        r = (r * 255) / 31;
-        g = (g * 255) / 63;
-        b = (b * 255) / 31;
-        uint32_t color24 = ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+        const uint32_t color24 = _color565to24(color);
 
         while (count > 1)
         {
@@ -1643,6 +2129,67 @@ namespace ILI9488_T4
         }
     }
 
+    void ILI9488Driver::_writePixels(const uint16_t *src, int n, int step)
+    {
+        if (n >= 4)
+        { // 4 pixels = 12 bytes = 3 words of 32 bits
+            _maybeUpdateTCR(_tcr_dc_not_assert | LPSPI_TCR_FRAMESZ(31) | LPSPI_TCR_CONT | LPSPI_TCR_RXMSK);
+            while (n >= 4)
+            {
+                const uint32_t c0 = _color565to24(src[0]);
+                const uint32_t c1 = _color565to24(src[step]);
+                const uint32_t c2 = _color565to24(src[2 * step]);
+                const uint32_t c3 = _color565to24(src[3 * step]);
+                src += 4 * step;
+                n -= 4;
+                _waitFifoRoom(3);
+                _pimxrt_spi->TDR = (c0 << 8) | (c1 >> 16);
+                _pimxrt_spi->TDR = (c1 << 16) | (c2 >> 8);
+                _pimxrt_spi->TDR = (c2 << 24) | c3;
+            }
+        }
+        if (n > 0)
+        { // remaining pixels are sent with 24 bits frames
+            _maybeUpdateTCR(_tcr_dc_not_assert | LPSPI_TCR_FRAMESZ(23) | LPSPI_TCR_CONT | LPSPI_TCR_RXMSK);
+            while (n-- > 0)
+            {
+                const uint32_t c = _color565to24(*src);
+                src += step;
+                _waitFifoRoom(1);
+                _pimxrt_spi->TDR = c;
+            }
+        }
+    }
+
+    void ILI9488Driver::_writeColor(uint16_t color, int n)
+    {
+        const uint32_t c = _color565to24(color);
+        if (n >= 4)
+        {
+            const uint32_t w0 = (c << 8) | (c >> 16);
+            const uint32_t w1 = (c << 16) | (c >> 8);
+            const uint32_t w2 = (c << 24) | c;
+            _maybeUpdateTCR(_tcr_dc_not_assert | LPSPI_TCR_FRAMESZ(31) | LPSPI_TCR_CONT | LPSPI_TCR_RXMSK);
+            while (n >= 4)
+            {
+                n -= 4;
+                _waitFifoRoom(3);
+                _pimxrt_spi->TDR = w0;
+                _pimxrt_spi->TDR = w1;
+                _pimxrt_spi->TDR = w2;
+            }
+        }
+        if (n > 0)
+        {
+            _maybeUpdateTCR(_tcr_dc_not_assert | LPSPI_TCR_FRAMESZ(23) | LPSPI_TCR_CONT | LPSPI_TCR_RXMSK);
+            while (n-- > 0)
+            {
+                _waitFifoRoom(1);
+                _pimxrt_spi->TDR = c;
+            }
+        }
+    }
+
     /**********************************************************************************************************
     * DMA Interrupts
     ***********************************************************************************************************/
@@ -1655,7 +2202,6 @@ namespace ILI9488_T4
         _dmatx.clearInterrupt();
         _dmatx.clearComplete();
         _restartCpuTime();
-        _stats_nb_transactions++; // count a spi transaction
         _subFrameInterruptDiff();
         _pauseCpuTime();
         interrupts();
@@ -1699,11 +2245,12 @@ namespace ILI9488_T4
         _writedata16_cont(xmin);
         _writedata16_cont(xmax);
         _writecommand_cont(ILI9488_T4_RAMWR);
-        for (int i = 0; i < (xmax - xmin + 1) * (ymax - ymin + 1); i++)
-            _write16BitColor(color);
+        _writeColor(color, (xmax - xmin + 1) * (ymax - ymin + 1));
         _writecommand_last(ILI9488_T4_NOP);
         _endSPITransaction();
         _mirrorfb = nullptr;
+        _tile_hashes_valid = false;
+        _generation_valid = false;
         _ongoingDiff = nullptr;
     }
 
@@ -1783,7 +2330,10 @@ namespace ILI9488_T4
         _statsvar_transactions.reset();
         _statsvar_margin.reset();
         _statsvar_vsyncspacing.reset();
+        _statsvar_diffgap.reset();
         _nbteared = 0;
+        _nb_scrolled = 0;
+        _nb_interlaced = 0;
     }
 
     FLASHMEM void ILI9488Driver::printStats() const
@@ -1848,7 +2398,13 @@ namespace ILI9488_T4
             {
                 _print("- diff. updates      : ENABLED - 1 diff buffer.\n");
             }
-            _printf("- diff [gap]         : %u\n", _diff_gap);
+            if (_diff_gap_auto)
+            {
+                _printf("- diff [gap]         : %u (AUTO - transaction cost: %.1f pixels) ", _diff_gap, _transaction_cost);
+                _statsvar_diffgap.print("", "\n", _outputStream);
+            }
+            else
+                _printf("- diff [gap]         : %u\n", _diff_gap);
             if (_compare_mask == 0)
             {
                 _print("- diff [compare_mask]: STRICT COMPARISON.");
@@ -1871,10 +2427,35 @@ namespace ILI9488_T4
                     _print(bitRead(_compare_mask, i) ? '1' : '0');
                 }
             }
+            if ((_tol_red | _tol_green | _tol_blue) != 0)
+                _printf("\n- diff [tolerance]   : R=%i G=%i B=%i", _tol_red, _tol_green, _tol_blue);
+            if (_diff_band_rows > 0)
+                _printf("\n- diff [streaming]   : bands of %i rows", _diff_band_rows);
+            if (_scroll_hashes)
+                _printf("\n- diff [hw scroll]   : rows [%i,%i]", _scroll_tfa, _scroll_tfa + _scroll_vsa - 1);
+            if (_interlace_threshold > 0)
+                _printf("\n- diff [interlace]   : above %i pixels", _interlace_threshold);
+            if (_hysteresis)
+            {
+                _print("\n- diff [hysteresis]  : pixels held per frame ");
+                _hysteresis->statsHeld().print("", "", _outputStream);
+            }
+            for (int k = 0; k < DiffBuffBase::MAX_COMPARE_REGIONS; k++)
+            {
+                if (_cmp_region_on[k])
+                {
+                    _printf("\n- diff [region %i]    : ", k);
+                    _printf("[%i,%i]x[%i,%i]", _cmp_region[k].xmin, _cmp_region[k].xmax, _cmp_region[k].ymin, _cmp_region[k].ymax);
+                    _printf(" mask=%04X tolerance ", (int)_cmp_region_mask[k]);
+                    _printf("R=%i G=%i B=%i", _cmp_region_tol[k][0], _cmp_region_tol[k][1], _cmp_region_tol[k][2]);
+                }
+            }
         }
         else
         {
-            if (_diff1 == nullptr)
+            if ((_diff1 != nullptr) && (_tile_hashes != nullptr) && (bufferingMode() == NO_BUFFERING))
+                _print("- diff. updates      : MIRROR-FREE - tile hashes (only with DiffBuffTiled).\n");
+            else if (_diff1 == nullptr)
                 _print("- diff. updates      : DISABLED.\n");
             else
                 _print("- differential update: DISABLED [ONLY 1 DIFF BUFFER PROVIDED WHEN 2 ARE NEEDED WITH TRIPLE BUFFERING]\n");
@@ -1894,6 +2475,10 @@ namespace ILI9488_T4
         _statsvar_uploaded_pixels.print("", "\n", _outputStream);
         _print("- transact. / frame  : ");
         _statsvar_transactions.print("", "\n", _outputStream);
+        if (_scroll_hashes)
+            _printf("- hw scrolled frames : %u\n", statsNbScrolled());
+        if (_interlace_threshold > 0)
+            _printf("- interlaced frames  : %u\n", statsNbInterlaced());
         if (_vsync_spacing > 0)
         {
             _printf("- teared frames      : %u (%.1f%%)\n", statsNbTeared(), 100 * statsRatioTeared());
@@ -1929,6 +2514,35 @@ namespace ILI9488_T4
 
             _statsvar_margin.push(_margin);
         }
+
+        _adaptDiffGap();
+    }
+
+    void ILI9488Driver::_adaptDiffGap()
+    {
+        if ((!_diff_gap_auto) || (!diffUpdateActive()))
+            return;
+        // cost model: upload time = pixel_time * (pixels + transaction_cost * transactions)
+        const float pixel_time = (8000000.0f * ILI9488_T4_BYTES_PER_PIXEL) / _spi_clock; // time to upload a pixel (in us)
+        if ((_stats_nb_transactions >= 8) && (_stats_uploadtime > 0))
+        { // enough transactions for a meaningful estimate.
+            float c = ((_stats_uploadtime / pixel_time) - _stats_nb_uploaded_pixels) / _stats_nb_transactions;
+            c = _clip<float>(c, 1.0f, (float)ILI9488_T4_AUTO_DIFF_GAP_MAX);
+            _transaction_cost += 0.1f * (c - _transaction_cost); // smooth over frames.
+        }
+        // memory constraint: raise the gap quickly when a diff buffer is (almost) full and decrease it slowly otherwise.
+        float u = (_diff1) ? _diff1->usage() : 0.0f;
+        if ((_diff2) && (_diff2->usage() > u))
+            u = _diff2->usage();
+        if (u >= 0.9f)
+            _diff_gap_min = _clip<int>(_diff_gap + 1 + _diff_gap / 4, ILI9488_T4_AUTO_DIFF_GAP_MIN, ILI9488_T4_AUTO_DIFF_GAP_MAX);
+        else if ((u < 0.5f) && (_diff_gap_min > ILI9488_T4_AUTO_DIFF_GAP_MIN))
+            _diff_gap_min--;
+        int g = (int)(_transaction_cost + 0.5f);
+        if (g < _diff_gap_min)
+            g = _diff_gap_min;
+        _diff_gap = _clip<int>(g, ILI9488_T4_AUTO_DIFF_GAP_MIN, ILI9488_T4_AUTO_DIFF_GAP_MAX);
+        _statsvar_diffgap.push(_diff_gap);
     }
 
     /**********************************************************************************************************
@@ -2213,6 +2827,7 @@ namespace ILI9488_T4
     FLASHMEM void ILI9488Driver::calibrateTouch(int touchCalibration[4])
     {
         waitUpdateAsyncComplete();
+        _resetScroll();
         const int RADIUS = 6;
         _print("\n\n------------- Touch Calibration ---------------\n");
         int x[4];
@@ -2291,6 +2906,8 @@ namespace ILI9488_T4
                     _print("------------- end of calibration --------------\n\n");
                     _rotation = _oldrotation; // restore orientation
                     _mirrorfb = nullptr;
+                    _tile_hashes_valid = false;
+                    _generation_valid = false;
                     _ongoingDiff = nullptr;
                     resync();
                     return;
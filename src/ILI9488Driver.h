@@ -58,20 +58,29 @@ namespace ILI9488_T4
 
 #define ILI9488_T4_DEFAULT_VSYNC_SPACING 2       // vsync on with framerate = refreshrate/2 = 45FPS.
 #define ILI9488_T4_DEFAULT_DIFF_GAP 6            // default gap for diffs (typ. between 4 and 50)
+#define ILI9488_T4_DEFAULT_DIFF_BAND_ROWS 32     // default number of rows per band when streaming diffs with setDiffStreaming().
 #define ILI9488_T4_DEFAULT_LATE_START_RATIO 0.3f // default "proportion" of the frame admissible for late frame start when using vsync.
 
-#define ILI9488_T4_TRANSACTION_DURATION 3            // number of pixels that could be uploaded during a typical CASET/PASET/RAWR sequence.
+#define ILI9488_T4_BYTES_PER_PIXEL 3                 // number of bytes sent per pixel (18 bits interface pixel format).
+#define ILI9488_T4_TRANSACTION_DURATION 4            // number of pixels that could be uploaded during a typical CASET/PASET/RAWR sequence (11 bytes).
+#define ILI9488_T4_AUTO_DIFF_GAP_MIN 2               // minimum gap chosen in automatic mode.
+#define ILI9488_T4_AUTO_DIFF_GAP_MAX 64              // maximum gap chosen in automatic mode.
 #define ILI9488_T4_RETRY_INIT 5                      // number of times we try initialization in begin() before returning an error.
-#define ILI9488_T4_TFTWIDTH 320                      // screen dimension x (in default orientation 0)
-#define ILI9488_T4_TFTHEIGHT 480                     // screen dimension y (in default orientation 0)
+// ILI9488_T4_TFTWIDTH, ILI9488_T4_TFTHEIGHT (screen dimensions in orientation 0) are set in DiffBuff.h
 #define ILI9488_T4_NB_SCANLINES ILI9488_T4_TFTHEIGHT // scanlines are mapped to the screen height
 #define ILI9488_T4_MIN_WAIT_TIME 300                 // minimum waiting time (in us) before drawing again when catching up with the scanline
 
 #define ILI9488_T4_NB_PIXELS (ILI9488_T4_TFTWIDTH * ILI9488_T4_TFTHEIGHT) // total number of pixels
+#define ILI9488_T4_NB_TILE_HASHES (ILI9488_T4::DiffBuffTiled::NB_TILES) // number of tile hashes for mirror-free diffs (see setTileHashes())
+#define ILI9488_T4_NB_SCROLL_HASHES (2 * ILI9488_T4_TFTHEIGHT)          // number of row hashes for hardware scroll detection (see setAutoScroll())
+#define ILI9488_T4_SCROLL_MIN_GAIN 16                                  // minimum number of rows saved for using a hardware scroll
 
 #define ILI9488_T4_MAX_VSYNC_SPACING 10           // maximum number of screen refresh between frames (for sync clock stability).
 #define ILI9488_T4_IRQ_PRIORITY 128               // priority at which we run the irqs (dma and pit timer).
 #define ILI9488_T4_MAX_DELAY_MICROSECONDS 1000000 // maximum waiting time (1 second)
+#define ILI9488_T4_DMA_LINEBUF_SIZE 320           // number of pixels converted to RGB666 per DMA chunk (two such line buffers are used)
+#define ILI9488_T4_TX_FIFO_SIZE 16                // depth of the LPSPI transmit fifo (in 32 bit words)
+#define ILI9488_T4_PIXEL_BUF_SIZE 128             // size of the stack buffer used to gather rotated pixels for the blocking writer (must be a multiple of 4)
 
 #define ILI9488_T4_TOUCH_Z_THRESHOLD 400    // for touch
 #define ILI9488_T4_TOUCH_Z_THRESHOLD_INT 75 // same as https://github.com/PaulStoffregen/XPT2046_Touchscreen/blob/master/XPT2046_Touchscreen.cpp
@@ -110,6 +119,7 @@ namespace ILI9488_T4
 #define ILI9488_T4_RAMRD 0x2E
 
 #define ILI9488_T4_PTLAR 0x30
+#define ILI9488_T4_VSCRDEF 0x33
 #define ILI9488_T4_MADCTL 0x36
 #define ILI9488_T4_VSCRSADD 0x37
 #define ILI9488_T4_PIXFMT 0x3A
@@ -307,6 +317,8 @@ namespace ILI9488_T4
     * 
     * offset can be any value (positive or negative) so that incrementing / decrementing it enables
     * to scroll up or down continuously.
+    * 
+    * NOTE: calling this method disables automatic hardware scrolling (see setAutoScroll()).
     **/
         void setScroll(int offset = 0);
 
@@ -675,16 +687,103 @@ namespace ILI9488_T4
         void setDiffGap(int gap = ILI9488_T4_DEFAULT_DIFF_GAP)
         {
             waitUpdateAsyncComplete();
+            _diff_gap_auto = false;
             _diff_gap = ILI9488Driver::_clip<int>((int)gap, (int)1, (int)ILI9488_T4_NB_PIXELS);
             statsReset();
             resync();
         }
 
+        /**
+    * Enable/disable automatic tuning of the diff gap. 
+    * 
+    * In automatic mode, the driver measures after each frame the bus time taken by a transaction 
+    * (CASET/PASET/RAMWR and DMA restart) from the upload time, number of pixels and number of 
+    * transactions of the frame. The gap is then set to this cost (expressed in pixels) since 
+    * merging a run of identical pixels is worth it only when it is shorter than the cost of 
+    * starting a new transaction. The gap is raised further when the diff buffers come close 
+    * to overflow. 
+    * 
+    * Calling setDiffGap() disables automatic mode. 
+    *
+    * Remark: calling this method reset the statistics.
+    **/
+        void setDiffGapAuto(bool enable = true)
+        {
+            waitUpdateAsyncComplete();
+            _diff_gap_auto = enable;
+            _transaction_cost = ILI9488_T4_TRANSACTION_DURATION;
+            _diff_gap_min = ILI9488_T4_AUTO_DIFF_GAP_MIN;
+            statsReset();
+            resync();
+        }
+
+        /**
+    * Return true if the diff gap is tuned automatically.
+    **/
+        bool getDiffGapAuto() const { return _diff_gap_auto; }
+
         /**
     * Return the current gap used for creating diffs. 
     **/
         int getDiffGap() const { return _diff_gap; }
 
+        /**
+    * Enable (band_rows > 0) or disable (band_rows = 0) streaming of diffs. 
+    * 
+    * In DOUBLE_BUFFERING mode, when update() is called while no upload is in progress, the diff 
+    * is normally computed completely before the upload starts. With streaming enabled, the diff
+    * is computed by bands of 'band_rows' rows (in orientation 0) and the upload starts as soon as
+    * the first band with changes is ready: the DMA interrupt then uploads band k while band k+1 
+    * is being computed so the latency of update() gets close to the pure transfer time. 
+    * 
+    * Streaming is only possible with DiffBuff objects, without hysteresis and without dirty
+    * rectangles (update() falls back to the usual method otherwise). Row checksums are not 
+    * used while streaming is enabled. 
+    **/
+        void setDiffStreaming(int band_rows = ILI9488_T4_DEFAULT_DIFF_BAND_ROWS)
+        {
+            waitUpdateAsyncComplete();
+            _diff_band_rows = ILI9488Driver::_clip<int>(band_rows, 0, ILI9488_T4_TFTHEIGHT);
+            _row_sums_valid = false;
+        }
+
+        /**
+    * Return the number of rows per band when streaming diffs (0 if disabled). 
+    **/
+        int getDiffStreaming() const { return _diff_band_rows; }
+
+        /**
+    * Enable (threshold > 0) or disable (threshold = 0) interlaced uploads for overloaded frames. 
+    * 
+    * In DOUBLE_BUFFERING mode, when the diff of a frame writes more than 'threshold' pixels, it is
+    * uploaded in two passes: first the rows (in orientation 0) of one parity and then, from the 
+    * interrupt that ends the first pass, the rows of the other parity. With vsync enabled, the 
+    * second pass is timed for the refresh right after the first one, whatever the vsync spacing, 
+    * so the frame is complete within two refreshes. The parity sent first alternates from one 
+    * such frame to the next. Under load, half of the rows are thus refreshed twice as fast and 
+    * the screen shows the exact frame once the second pass is done, without calling update() again. 
+    * 
+    * The whole frame is diffed and copied into the internal framebuffer only once: each pass just
+    * reads the rows of its parity from the same diff. The second pass counts as an upload in the
+    * stats and a new update() waits for it to complete as for any upload. 
+    * 
+    * A good threshold is the number of pixels that can be uploaded during one refresh, i.e. 
+    * spi_clock / (24 * refresh_rate) (about 27000 pixels at 40MHz and 60Hz). 
+    * 
+    * Streaming (see setDiffStreaming()) is not used while interlacing is enabled since the size
+    * of the diff must be known before the upload starts. 
+    **/
+        void setInterlace(int threshold = 0)
+        {
+            waitUpdateAsyncComplete();
+            _interlace_threshold = (threshold < 0) ? 0 : threshold;
+        }
+
+        /**
+    * Return the threshold for interlaced uploads (0 if disabled). 
+    **/
+        int getInterlace() const { return _interlace_threshold; }
+
         /**
     * Set the mask used when creating a diff to check is a pixel is the same in both framebuffers. 
     * If the mask set is non-zero, then only the bits set in the mask are used for the comparison 
@@ -728,6 +827,167 @@ namespace ILI9488_T4
     **/
         uint16_t getCompareMask() const { return _compare_mask; }
 
+        /**
+    * Set a per channel tolerance for the comparison of pixels when creating a diff: two pixels
+    * are considered equal when the differences between their red, green and blue components are
+    * at most tol_red, tol_green and tol_blue (in RGB565 units: 5 bits for red and blue and 6 bits
+    * for green). 
+    * 
+    * Contrarily to the compare mask which only drops the lower bits (so that a red value going 
+    * from 15 to 16 is a change whereas 8 -> 15 is not), this treats all small variations the same 
+    * way which is better suited for camera/video content. 
+    * 
+    * When enabled, the tolerance takes precedence over the compare mask. Call without argument to
+    * disable it (default). The tolerance is only supported by DiffBuff objects. 
+    **/
+        void setDiffTolerance(int tol_red = 0, int tol_green = 0, int tol_blue = 0)
+        {
+            waitUpdateAsyncComplete();
+            _tol_red = tol_red;
+            _tol_green = tol_green;
+            _tol_blue = tol_blue;
+            if (_diff1)
+                _diff1->setCompareTolerance(_tol_red, _tol_green, _tol_blue);
+            if (_diff2)
+                _diff2->setCompareTolerance(_tol_red, _tol_green, _tol_blue);
+        }
+
+        /**
+    * Set (or remove with nullptr) a temporal hysteresis for differential updates (see DiffHysteresis
+    * in DiffBuff.h). With hysteresis, a pixel that differs from the screen is only uploaded after it
+    * has differed during several consecutive frames, or straight away if the change is large. This
+    * is useful for noisy sources (camera) where most pixels would otherwise flicker by one LSB and be
+    * re-uploaded at every frame. The number of pixels held back is available with hyst->statsHeld(). 
+    *
+    * The internal framebuffer keeps mirroring exactly what is on the screen. Only supported by 
+    * DiffBuff objects and only used by update() (not by updateRegion()). 
+    **/
+        void setDiffHysteresis(DiffHysteresis *hyst)
+        {
+            waitUpdateAsyncComplete();
+            _hysteresis = hyst;
+            _row_sums_valid = false;
+            if (_diff1)
+                _diff1->setHysteresis(_hysteresis);
+            if (_diff2)
+                _diff2->setHysteresis(_hysteresis);
+        }
+
+        /**
+    * Set the compare region number 'index' (0 <= index < DiffBuffBase::MAX_COMPARE_REGIONS). Pixels
+    * inside the box [xmin, xmax] x [ymin, ymax] (in the coordinates of the framebuffer given to 
+    * update(), i.e. w.r.t. the current rotation) are compared with their own compare mask or per 
+    * channel tolerance (same meaning as setDiffCompareMask() and setDiffTolerance()) instead of the 
+    * global ones. Use it to allow a lossy comparison for a video area while keeping text and gauges
+    * exact (or the converse). When regions overlap, the one with the lowest index wins. 
+    * 
+    * Only supported by DiffBuff objects and only used by update() (not by updateRegion()). 
+    **/
+        void setDiffCompareRegion(int index, int xmin, int xmax, int ymin, int ymax, uint16_t compare_mask = 0, int tol_red = 0, int tol_green = 0, int tol_blue = 0)
+        {
+            if ((index < 0) || (index >= DiffBuffBase::MAX_COMPARE_REGIONS))
+                return;
+            waitUpdateAsyncComplete();
+            _cmp_region_on[index] = true;
+            _cmp_region[index] = {xmin, xmax, ymin, ymax};
+            _cmp_region_mask[index] = compare_mask;
+            _cmp_region_tol[index][0] = tol_red;
+            _cmp_region_tol[index][1] = tol_green;
+            _cmp_region_tol[index][2] = tol_blue;
+            _row_sums_valid = false;
+            _setCompareRegion(_diff1, index);
+            _setCompareRegion(_diff2, index);
+        }
+
+        /**
+    * Remove the compare region number 'index'. 
+    **/
+        void removeDiffCompareRegion(int index)
+        {
+            if ((index < 0) || (index >= DiffBuffBase::MAX_COMPARE_REGIONS))
+                return;
+            waitUpdateAsyncComplete();
+            _cmp_region_on[index] = false;
+            _setCompareRegion(_diff1, index);
+            _setCompareRegion(_diff2, index);
+        }
+
+        /**
+    * Return the current per channel tolerance (all 0 when disabled). 
+    **/
+        void getDiffTolerance(int &tol_red, int &tol_green, int &tol_blue) const
+        {
+            tol_red = _tol_red;
+            tol_green = _tol_green;
+            tol_blue = _tol_blue;
+        }
+
+        /**
+    * Set/remove a buffer holding one checksum per row of the internal framebuffer. 
+    * 
+    * The buffer must have room for ILI9488_T4_TFTHEIGHT uint32_t (i.e. 1920 bytes for a 320x480 panel). When set, the driver 
+    * keeps the checksum of each row of the framebuffer that mirrors the screen and the diff only needs 
+    * to checksum the rows of the new frame: rows with a matching checksum are considered unchanged 
+    * and the internal framebuffer is not even read for them. This roughly halves the memory traffic 
+    * needed to compute diffs when most of the screen is static.
+    * 
+    * Row checksums are only used in DOUBLE_BUFFERING mode with differential updates enabled and 
+    * when the rotation is 0 (they are simply ignored otherwise).
+    *
+    * The row checksums are 32 bit hashes so, in theory, a changed row may (extremely rarely) 
+    * be considered unchanged. Call the method without argument to remove the buffer. 
+    **/
+        void setRowChecksums(uint32_t *row_sums = nullptr)
+        {
+            waitUpdateAsyncComplete();
+            _row_sums = row_sums;
+            _row_sums_valid = false;
+        }
+
+        /**
+    * Set/remove a buffer holding one hash per tile of the screen for "mirror-free" differential updates. 
+    * 
+    * The buffer must have room for ILI9488_T4_NB_TILE_HASHES uint32_t (i.e. 2400 bytes for a 320x480 panel). 
+    * This is used in NO_BUFFERING mode (no internal framebuffer) when the diff buffer set with setDiffBuffers()
+    * is a DiffBuffTiled: instead of mirroring the screen in a 300KB internal framebuffer, the driver only keeps
+    * the hash of each 16x16 tile of the screen and update() uploads, straight from the user framebuffer, the 
+    * tiles whose hash changed. Differential updates are thus possible for about 1% of the memory cost of the
+    * mirror, but with tile granularity and without DMA (the upload is done immediately as in NO_BUFFERING mode).
+    *
+    * The tile hashes are 32 bit hashes so, in theory, a changed tile may (extremely rarely) not be uploaded.
+    * Call the method without argument to remove the buffer. 
+    **/
+        void setTileHashes(uint32_t *tile_hashes = nullptr)
+        {
+            waitUpdateAsyncComplete();
+            _tile_hashes = tile_hashes;
+            _tile_hashes_valid = false;
+        }
+
+        /**
+    * Set/remove a buffer used to detect scrolling and perform it in hardware (VSCRDEF/VSCRSADD commands).
+    * 
+    * The buffer must have room for ILI9488_T4_NB_SCROLL_HASHES uint32_t (i.e. 3840 bytes for a 320x480 panel).
+    * [ymin, ymax] is the scroll area given in rows of the screen in orientation 0 (PORTRAIT_320x480): the 
+    * scrolling is thus vertical in portrait mode and horizontal in landscape mode. 
+    * 
+    * At each update(), the driver hashes the rows of the new frame and looks for a uniform shift of the 
+    * content of the scroll area compared to the previous frame. When one is found (and saves at least 
+    * ILI9488_T4_SCROLL_MIN_GAIN rows), the internal framebuffer is shifted accordingly, the display is told 
+    * to scroll and only the rows that newly appear (plus the other changes) are uploaded instead of the 
+    * whole scroll area. 
+    * 
+    * Only used in DOUBLE_BUFFERING mode with differential updates, when update() is called without dirty
+    * rectangles and while no upload is in progress: with two diff buffers, a frame diffed while the previous
+    * one is still being uploaded is not checked for scrolling (it is uploaded with a regular diff). 
+    * 
+    * The scroll command is sent when the upload of the frame starts (at the same vsync-timed point). The
+    * rest of the screen is then shifted right away but the rows that newly appear are uploaded behind the
+    * scanline so, during the refresh in which the upload starts, they may still show their old content. 
+    * Call the method without argument to remove the buffer (and disable automatic scrolling). 
+    **/
+        void setAutoScroll(uint32_t *row_hashes = nullptr, int ymin = 0, int ymax = ILI9488_T4_TFTHEIGHT - 1);
+
         /***************************************************************************************************
     ****************************************************************************************************
     *
@@ -843,6 +1103,44 @@ namespace ILI9488_T4
     **/
         void update(const uint16_t *fb, bool force_full_redraw = false);
 
+        /**
+    * Same as update(fb) but with a hint telling which parts of the frame may have changed.
+    *
+    * - dirty is an array of nb_dirty rectangles (in the coordinates of fb, i.e. w.r.t. the 
+    *   current rotation, bounds included) outside of which fb is guaranteed to be identical
+    *   to the framebuffer passed to the previous call to update(). Only the pixels inside
+    *   these rectangles are compared and copied so the time spent computing the diff is 
+    *   proportional to the dirty area instead of the whole screen. 
+    *
+    * - if dirty is nullptr, this is the same as calling update(fb).
+    *
+    * NOTE: the hint is used for differential updates in double and triple buffering mode. It is
+    *       ignored (and the whole frame is diffed/redrawn) when a full redraw is needed anyway or,
+    *       in triple buffering mode, when the new frame replaces a frame still waiting to be 
+    *       uploaded. At most DiffBuffBase::MAX_DIRTY_RECTS rectangles are handled separately: 
+    *       the extra ones are merged together. 
+    **/
+        void update(const uint16_t *fb, const Rect *dirty, int nb_dirty);
+
+        /**
+    * Same as update(fb) but with a generation number (or any cheap hash of the content) supplied 
+    * by the caller: the value must change whenever the content of fb changes. 
+    * 
+    * If generation is equal to the value passed in the previous call and the screen was not 
+    * redrawn by other means in between, the frame is considered unchanged: no diff is computed and
+    * the framebuffer is not copied. The frame still counts as an (empty) update so that vsync 
+    * pacing and the statistics stay consistent, exactly as when update() finds an empty diff.
+    * 
+    * In double buffering mode, the method first waits for the upload in progress (if any), as 
+    * update() does, before recording the frame. 
+    * 
+    * NOTE: a frame dropped by update() (double buffering with vsync_spacing = -1) is not recorded
+    *       so the next call with the same generation performs a regular update. In triple buffering
+    *       mode, an unchanged frame submitted while an upload is in progress is not recorded either: 
+    *       the frame being uploaded (or waiting to be) already has this content. 
+    **/
+        void updateIfChanged(const uint16_t *fb, uint32_t generation);
+
         /**
     *                             PARTIAL SCREEN UPDATE METHOD
     *
@@ -971,7 +1269,7 @@ namespace ILI9488_T4
         {
             if ((!diffUpdateActive()) || (_statsvar_transactions.count() == 0))
                 return 1.0f;
-            return ((float)(ILI9488_T4_NB_PIXELS * 16)) / ((float)_spi_clock) * (1000000.0f / _statsvar_uploadtime.avg());
+            return ((float)(ILI9488_T4_NB_PIXELS * 8 * ILI9488_T4_BYTES_PER_PIXEL)) / ((float)_spi_clock) * (1000000.0f / _statsvar_uploadtime.avg());
         }
 
         /**
@@ -1003,6 +1301,16 @@ namespace ILI9488_T4
     **/
         float statsRatioTeared() const { return (_vsync_spacing <= 0) ? 1.0f : ((_statsvar_vsyncspacing.count() == 0) ? 0.0f : (((float)_nbteared) / _statsvar_margin.count())); }
 
+        /**
+    * Return the number of frames for which a hardware scroll was performed (see setAutoScroll()).
+    **/
+        uint32_t statsNbScrolled() const { return _nb_scrolled; }
+
+        /**
+    * Return the number of frames uploaded interlaced, i.e. in two passes of half of their rows (see setInterlace()).
+    **/
+        uint32_t statsNbInterlaced() const { return _nb_interlaced; }
+
         /**
     * Output statistics about the object into a stream.
     * 
@@ -1186,10 +1494,42 @@ namespace ILI9488_T4
     ***********************************************************************************************************/
 
         volatile int _diff_gap;                   // gap when creating diffs.
+        int _diff_band_rows;                      // number of rows per band when streaming diffs (0 = disabled).
+        volatile bool _diff_gap_auto;             // true if the gap is tuned automatically.
+        volatile float _transaction_cost;         // estimated cost of a transaction (in pixels) for the automatic gap.
+        volatile int _diff_gap_min;               // minimum gap (raised when the diff buffers are close to overflow) for the automatic gap.
         volatile int _vsync_spacing;              // update stategy / framerate divider.
         volatile float _late_start_ratio;         // late start parameter (by how much we can miss the first sync line and still start the frame without waiting for the next refresh).
         volatile bool _late_start_ratio_override; // if true the next frame upload will wait for the scanline to start a next frame.
         volatile uint16_t _compare_mask;          // the compare mask used to compare pixels when doing a diff
+        int _tol_red, _tol_green, _tol_blue;      // per channel tolerance used to compare pixels when doing a diff (0 = disabled)
+        DiffHysteresis *_hysteresis;              // temporal hysteresis used when doing a diff (nullptr = disabled)
+        Rect _cmp_region[DiffBuffBase::MAX_COMPARE_REGIONS];              // compare regions (in the coordinates of the framebuffer)
+        uint16_t _cmp_region_mask[DiffBuffBase::MAX_COMPARE_REGIONS];     // their compare masks
+        int _cmp_region_tol[DiffBuffBase::MAX_COMPARE_REGIONS][3];        // and their per channel tolerances
+        bool _cmp_region_on[DiffBuffBase::MAX_COMPARE_REGIONS];           // true if the region is set
+
+        /** forward compare region 'index' to a diff buffer */
+        void _setCompareRegion(DiffBuffBase *diff, int index)
+        {
+            if (diff == nullptr)
+                return;
+            if (_cmp_region_on[index])
+                diff->setCompareRegion(index, _cmp_region + index, _cmp_region_mask[index], _cmp_region_tol[index][0], _cmp_region_tol[index][1], _cmp_region_tol[index][2]);
+            else
+                diff->setCompareRegion(index, nullptr);
+        }
+
+        /** return true if at least one compare region is set */
+        bool _hasCompareRegions() const
+        {
+            for (int k = 0; k < DiffBuffBase::MAX_COMPARE_REGIONS; k++)
+            {
+                if (_cmp_region_on[k])
+                    return true;
+            }
+            return false;
+        }
 
         DiffBuffBase *volatile _diff1;       // first diff buffer
         DiffBuffBase *volatile _diff2;       // second diff buffer (if non null, then _diff1 is also non zero).
@@ -1208,6 +1548,121 @@ namespace ILI9488_T4
 
         volatile bool _fb2full; // true if the second framebuffer is currently full and waiting to be uploaded.
 
+        uint32_t *volatile _row_sums; // checksums of the rows of _fb1 (or nullptr if not used).
+        volatile bool _row_sums_valid; // true if _row_sums matches the current content of _fb1.
+
+        uint32_t *_tile_hashes;         // hashes of the tiles of the screen for mirror-free diffs (or nullptr if not used).
+        bool _tile_hashes_valid;        // true if _tile_hashes matches the current screen content.
+
+        uint32_t _generation;           // generation number of the last frame passed to updateIfChanged().
+        bool _generation_valid;         // true if _generation matches the current screen content.
+
+        uint32_t *_scroll_hashes;       // row hashes for hardware scroll detection (or nullptr if not used): previous frame then new frame.
+        bool _scroll_hashes_valid;      // true if the first half of _scroll_hashes matches the rows of _fb1.
+        int _scroll_tfa;                // first row of the scroll area (in orientation 0).
+        int _scroll_vsa;                // number of rows of the scroll area.
+        int _scroll_off;                // current scroll: row _scroll_tfa + i of the screen shows row _scroll_tfa + ((i + _scroll_off) mod _scroll_vsa) of the LCD memory.
+        bool _scroll_dirty;             // true if VSCRDEF/VSCRSADD must be sent at the start of the next upload.
+        int _scroll_pend_x, _scroll_pend_y, _scroll_pend_w, _scroll_pend_len; // remainder of an instruction split at a seam of the scroll area.
+        uint32_t _nb_scrolled;          // number of frames for which a hardware scroll was performed.
+
+        /** return the row of the LCD memory displayed at row y of the screen. */
+        int _memRow(int y) const
+        {
+            return (((unsigned int)(y - _scroll_tfa)) < ((unsigned int)_scroll_vsa)) ? (_scroll_tfa + ((y - _scroll_tfa + _scroll_off) % _scroll_vsa)) : y;
+        }
+
+        /** same as diff->readDiffWindow() (with the rows of _upload_field only) but split the instructions whose rows are not contiguous in the LCD memory. */
+        int _readDiffWindow(DiffBuffBase *diff, int &x, int &y, int &w, int &len, int scanline);
+
+        /** 
+     * detect a vertical shift between _fb1 and fb in the scroll area and, if worth it, shift _fb1 and schedule the hardware scroll. 
+     * Not used with dirty rectangles (dirty != nullptr).
+     **/
+        void _scrollFrame(const uint16_t *fb, bool hashes_valid, const Rect *dirty);
+
+        /** return the shift d (in [0, _scroll_vsa[) such that row r of the new frame is row r + d of the previous one (0 if none worth it). */
+        int _findScroll(const uint32_t *old_h, const uint32_t *new_h) const;
+
+        /** return the number of rows r of the scroll area such that new_h[r] == old_h[r + d]. */
+        int _scrollScore(const uint32_t *old_h, const uint32_t *new_h, int d) const;
+
+        /** cyclic shift of nbrows rows of fb: row r receives row (r + d) mod nbrows. */
+        static void _rotateRows(uint16_t *fb, int nbrows, int d);
+
+        /** send VSCRDEF/VSCRSADD if needed. Called at the start of each upload. */
+        void _sendScroll();
+
+        /** set the scroll offset back to 0 (and invalidate the mirror if it was not). */
+        void _resetScroll();
+
+        /** return the row checksums to pass to computeDiff() (revalidated first if needed) or nullptr if not in use. */
+        uint32_t *_rowSums(bool revalidate = true)
+        {
+            if ((_row_sums == nullptr) || (_diff1 == nullptr) || (_rotation != 0) || (bufferingMode() != DOUBLE_BUFFERING) || (_hysteresis != nullptr) || (_hasCompareRegions()) || (_diff_band_rows > 0))
+            {
+                _row_sums_valid = false;
+                return nullptr;
+            }
+            if ((revalidate) && (!_row_sums_valid))
+                DiffBuffBase::rowChecksums(_fb1, DiffBuffBase::PORTRAIT_320x480, _row_sums);
+            _row_sums_valid = true; // computeDiff() keeps it in sync with _fb1.
+            return _row_sums;
+        }
+
+        /**
+     * Implementation of update(): dirty is the array of nb_dirty rectangles where fb may differ 
+     * from the previous frame (or nullptr if the whole frame may have changed). 
+     **/
+        void _update(const uint16_t *fb, bool force_full_redraw, const Rect *dirty, int nb_dirty);
+
+        /** compute the diff between _fb1 and fb, restricted to the dirty rectangles if any. */
+        void _diffFrame(DiffBuffBase *diff, const uint16_t *fb, bool copy_new_over_old, const Rect *dirty, int nb_dirty, bool use_row_sums = false)
+        {
+            const bool copy = (copy_new_over_old) && (_hysteresis == nullptr); // with hysteresis, copy what is uploaded afterward.
+            if (dirty)
+            {
+                _row_sums_valid = false; // the row checksums are not maintained when using dirty rectangles.
+                diff->computeDiff(_fb1, fb, getRotation(), dirty, nb_dirty, _diff_gap, copy, _compare_mask);
+            }
+            else
+                diff->computeDiff(_fb1, fb, getRotation(), _diff_gap, copy, _compare_mask, (use_row_sums ? _rowSums() : nullptr));
+            if (copy != copy_new_over_old)
+                DiffBuffBase::copyfb(_fb1, fb, getRotation(), diff);
+        }
+
+        /**
+     * Diff fb against _fb1 by bands (copying it into _fb1) and launch the upload as soon as the first 
+     * band with changes is ready. Return false (and do nothing) if streaming is not possible 
+     * (e.g. with dirty rectangles). 
+     **/
+        bool _streamFrame(DiffBuffBase *diff, const uint16_t *fb, const Rect *dirty);
+
+        int _interlace_threshold;   // number of pixels above which a frame is uploaded interlaced (0 = disabled).
+        int _interlace_field;       // parity of the rows uploaded first with the next interlaced frame.
+        volatile int _upload_field; // parity of the rows sent by the current upload (-1 = all rows).
+        uint32_t _nb_interlaced;    // number of frames uploaded interlaced.
+
+        /**
+     * Launch the upload of _diff1 from _fb1. If the diff writes more than _interlace_threshold pixels, 
+     * only one field is uploaded and _interlaceFieldCB() uploads the other one afterwards. 
+     **/
+        void _updateAsyncInterlaced();
+
+        /** called when the first field of an interlaced frame is uploaded: upload the second one. */
+        void _interlaceFieldCB();
+
+        /** copy fb into _fb1 (only the dirty rectangles if any, or only what diff uploads when using hysteresis). */
+        void _copyFrame(const uint16_t *fb, DiffBuffBase *diff, const Rect *dirty, int nb_dirty)
+        {
+            if (_hysteresis)
+                DiffBuffBase::copyfb(_fb1, fb, getRotation(), diff);
+            else if (dirty)
+                DiffBuffBase::copyfb(_fb1, fb, getRotation(), dirty, nb_dirty);
+            else
+                DiffBuffBase::copyfb(_fb1, fb, getRotation());
+        }
+
         /** called when fb2 is full and must be drawn on the screen */
         void _buffer2fullCB();
 
@@ -1261,8 +1716,11 @@ namespace ILI9488_T4
     * the old framebuffer and the new one 'fb'.
     * - return asap and update is async via DMA.
     * - uses the _vsync_spacing parameter to choose the vsync stategy.
+    * - only the rows of parity 'field' are uploaded if field >= 0 (see setInterlace()).
+    * - if next_refresh is true, the upload is timed for the refresh following the previous upload
+    *   whatever _vsync_spacing (used for the second field of an interlaced frame).
     **/
-        void _updateAsync(const uint16_t *fb, DiffBuffBase *diff);
+        void _updateAsync(const uint16_t *fb, DiffBuffBase *diff, int field = -1, bool next_refresh = false);
 
         /** clip val to [min,max] */
         template <typename T>
@@ -1334,9 +1792,19 @@ namespace ILI9488_T4
 
         uint32_t _dma_spi_tcr_deassert; // TCR value for deasserting DC
         uint32_t _dma_spi_tcr_assert;   // TCR value for asserting DC
+        uint32_t _dma_spi_tcr_param;    // TCR value for deasserting DC with 32 bit frames (CASET/PASET parameters)
 
-        int _prev_caset_x; // previous position set with the caset command
-        int _prev_paset_y; // previous position set with the paset command
+        int _prev_caset_x;  // previous start column set with the caset command
+        int _prev_caset_x2; // previous end column set with the caset command
+        int _prev_paset_y;  // previous position set with the paset command
+
+        uint32_t _dma_linebuf[2][ILI9488_T4_DMA_LINEBUF_SIZE]; // ping-pong line buffers: pixels converted to RGB666, one 24 bit SPI frame per pixel.
+        const uint16_t *volatile _dma_run_src;                  // next pixel (in _fb) of the current run that must be converted
+        volatile int _dma_run_remaining;                        // number of pixels of the current run not yet converted
+        volatile int _dma_run_w;                                // width of the window of the current run
+        volatile int _dma_run_col;                              // column (inside the window) of the next pixel to convert
+        volatile int _dma_chunk_len;                            // number of pixels staged in _dma_linebuf[_dma_chunk_buf] and waiting to be sent (0 = none)
+        volatile int _dma_chunk_buf;                            // index of the line buffer holding the staged chunk
 
         static void _dmaInterruptSPI0Diff()
         {
@@ -1362,6 +1830,40 @@ namespace ILI9488_T4
 
         void _dmaInterruptDiff(); // called when doing partial diff redraw
 
+        /** convert the next chunk of the current run into the line buffer not currently used by the DMA */
+        void _dmaStageChunk();
+
+        /** start the DMA transfer of the chunk previously staged with _dmaStageChunk() */
+        void _dmaSendChunk();
+
+        /** push the CASET/PASET (if needed) and RAMWR commands for the window [x, x2] x [y, ...] into the spi fifo */
+        void _dmaWriteWindow(int x, int x2, int y);
+
+        /** start a new run: window [x, x + w - 1] starting at line y with len pixels */
+        void _dmaStartRun(int x, int y, int w, int len)
+        {
+            _dma_run_src = _fb + x + (y * ILI9488_T4_TFTWIDTH);
+            _dma_run_remaining = len;
+            _dma_run_w = w;
+            _dma_run_col = 0;
+        }
+
+        /** index of the line following the instruction (x, y, w, len) */
+        static int _instructionEndLine(int x, int y, int w, int len)
+        {
+            return ((w == ILI9488_T4_TFTWIDTH - x) ? ((ILI9488_T4_TFTWIDTH * y + x + len) / ILI9488_T4_TFTWIDTH) : (y + len / w));
+        }
+
+        static const uint32_t _lut_red[32];   // 5 -> 6 bits expansion of the red channel, already shifted in place
+        static const uint32_t _lut_green[64]; // 6 bits green channel, already shifted in place
+        static const uint32_t _lut_blue[32];  // 5 -> 6 bits expansion of the blue channel, already shifted in place
+
+        /** convert a RGB565 color into the 24 bit frame expected by the screen (RGB666 in the upper bits of each byte) */
+        static uint32_t _color565to24(uint16_t color) __attribute__((always_inline))
+        {
+            return _lut_red[color >> 11] | _lut_green[(color >> 5) & 0x3F] | _lut_blue[color & 0x1F];
+        }
+
         /** set/remove  the callback at end of transfer */
         void _setCB(methodCB_t pcb = nullptr) { _pcb = pcb; }
 
@@ -1388,6 +1890,31 @@ namespace ILI9488_T4
 
         void _write16BitColor(uint16_t color, uint16_t count, bool last_pixel);
 
+        /**
+    * Bulk pixel writer for the blocking upload path: push n pixels src[0], src[step], src[2*step]...
+    * Groups of 4 pixels are packed into 3 words sent as 32 bit frames. The remaining pixels (if n is 
+    * not a multiple of 4) are sent as 24 bit frames. Data is sent with RXMSK so nothing must be read back. 
+    **/
+        void _writePixels(const uint16_t *src, int n, int step = 1);
+
+        /** Same as above but push n times the same color. */
+        void _writeColor(uint16_t color, int n);
+
+        /** wait until there is room for nbwords in the transmit fifo (and read pending rx bytes meanwhile) */
+        void _waitFifoRoom(int nbwords) __attribute__((always_inline))
+        {
+            uint32_t tmp __attribute__((unused));
+            do
+            {
+                if ((_pimxrt_spi->RSR & LPSPI_RSR_RXEMPTY) == 0)
+                {
+                    tmp = _pimxrt_spi->RDR; // Read any pending RX bytes in
+                    if (_pending_rx_count)
+                        _pending_rx_count--;
+                }
+            } while ((int)(_pimxrt_spi->FSR & 0x1f) > ILI9488_T4_TX_FIFO_SIZE - nbwords);
+        }
+
         /**********************************************************************************************************
     * About timing and vsync.
     ***********************************************************************************************************/
@@ -1616,6 +2143,11 @@ namespace ILI9488_T4
 
         StatsVar _statsvar_vsyncspacing; // statistics about the effective vsync_spacing
 
+        StatsVar _statsvar_diffgap; // statistics about the gap chosen in automatic mode.
+
+        /** update the diff gap from the statistics of the frame (automatic mode) */
+        void _adaptDiffGap();
+
         uint32_t _nbteared; // number of frame for which screen tearing may have occured.
 
         void _startframe(bool vsynonc)